@@ -0,0 +1,91 @@
+//
+//  ApiTest.cpp
+//  uscc
+//
+//  A small client of libuscc.a, for tests/testApi.py. It
+//  compiles sources held in memory through uscc::api::compile
+//  and checks the results. Prints each failed check, and
+//  exits with 1 if there were any.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#include "Compiler.h"
+#include <cstring>
+#include <iostream>
+
+using namespace uscc::api;
+
+static int numFailed = 0;
+
+static void check(bool condition, const char* what)
+{
+	if (!condition)
+	{
+		std::cout << "FAILED: " << what << std::endl;
+		numFailed++;
+	}
+}
+
+// The closing brace on line 6 has nothing to close
+static const char* BAD_SOURCE =
+	"int main()\n"
+	"{\n"
+	"\treturn 0;\n"
+	"}\n"
+	"\n"
+	"}\n";
+
+static const char* GOOD_SOURCE =
+	"int main()\n"
+	"{\n"
+	"\tprintf(\"%d\\n\", 6 * 7);\n"
+	"\treturn 0;\n"
+	"}\n";
+
+static CompileResult compileSource(const char* source, OutputKind output)
+{
+	CompileOptions options;
+	options.mOutput = output;
+	options.mOptimize = true;
+	return compile("api.usc", source, strlen(source), options);
+}
+
+int main()
+{
+	CompileResult bad = compileSource(BAD_SOURCE, OutputKind::Bitcode);
+	check(!bad.mSuccess, "a parse error fails the compile");
+	check(bad.mOutput.empty(), "a failed compile has no output");
+	check(bad.mDiagnostics.size() == 1, "a parse error gives one diagnostic");
+	if (!bad.mDiagnostics.empty())
+	{
+		const Diagnostic& diag = bad.mDiagnostics[0];
+		check(diag.mLineNum == 6 && diag.mColNum == 1, "the diagnostic is at 6:1");
+		check(diag.mMsg.find("Expected end of file") != std::string::npos,
+			  "the diagnostic says what was expected");
+	}
+	
+	CompileResult bitcode = compileSource(GOOD_SOURCE, OutputKind::Bitcode);
+	check(bitcode.mSuccess, "bitcode compiles");
+	check(bitcode.mDiagnostics.empty(), "bitcode has no diagnostics");
+	check(bitcode.mOutput.compare(0, 4, "BC\xC0\xDE") == 0, "bitcode starts with its magic");
+	
+	CompileResult assembly = compileSource(GOOD_SOURCE, OutputKind::Assembly);
+	check(assembly.mSuccess, "assembly compiles");
+	check(assembly.mOutput.find("main") != std::string::npos, "assembly defines main");
+	
+	CompileResult object = compileSource(GOOD_SOURCE, OutputKind::Object);
+	check(object.mSuccess, "an object file compiles");
+	check(!object.mOutput.empty(), "the object file isn't empty");
+	
+	if (numFailed == 0)
+	{
+		std::cout << "OK" << std::endl;
+	}
+	return numFailed == 0 ? 0 : 1;
+}
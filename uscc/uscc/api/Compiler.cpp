@@ -0,0 +1,85 @@
+//
+//  Compiler.cpp
+//  uscc
+//
+//  Implements the library interface to uscc.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#include "Compiler.h"
+#include "../parse/Parse.h"
+#include "../parse/ParseExcept.h"
+#include "../parse/Emitter.h"
+
+using namespace uscc;
+
+api::CompileResult api::compile(const char* name, const char* source, size_t length,
+								const CompileOptions& options)
+{
+	CompileResult result;
+	try
+	{
+		// Errors are collected rather than printed
+		parse::Parser parser(name, source, length, nullptr, nullptr, false);
+		for (auto& error : parser.GetErrors())
+		{
+			Diagnostic diag;
+			diag.mMsg = error->mMsg;
+			diag.mLineNum = error->mLineNum;
+			diag.mColNum = error->mColNum;
+			result.mDiagnostics.push_back(diag);
+		}
+		
+		if (!parser.IsValid())
+		{
+			return result;
+		}
+		
+		parse::Emitter emit(parser);
+		if (options.mOptimize)
+		{
+			emit.optimize();
+		}
+		
+		if (!emit.verify())
+		{
+			Diagnostic diag;
+			diag.mMsg = "Emitted bad IR";
+			diag.mLineNum = 0;
+			diag.mColNum = 0;
+			result.mDiagnostics.push_back(diag);
+			return result;
+		}
+		
+		switch (options.mOutput)
+		{
+			case OutputKind::Bitcode:
+				emit.emitBitcode(result.mOutput);
+				result.mSuccess = true;
+				break;
+			case OutputKind::Assembly:
+				result.mSuccess = emit.emitAsm(result.mOutput, options.mNumColors);
+				break;
+			case OutputKind::Object:
+				result.mSuccess = emit.emitObject(result.mOutput, options.mNumColors);
+				break;
+		}
+	}
+	catch (parse::ParseExcept& e)
+	{
+		Diagnostic diag;
+		diag.mMsg = "Critical error";
+		diag.mLineNum = 0;
+		diag.mColNum = 0;
+		result.mDiagnostics.push_back(diag);
+		result.mSuccess = false;
+	}
+	
+	return result;
+}
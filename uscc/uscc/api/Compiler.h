@@ -0,0 +1,78 @@
+//
+//  Compiler.h
+//  uscc
+//
+//  Declares the library interface to uscc, which compiles
+//  source text held in memory into bitcode, assembly or an
+//  object file, also held in memory. Nothing is read from
+//  or written to the filesystem.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace uscc
+{
+namespace api
+{
+
+// A single error reported while compiling
+struct Diagnostic
+{
+	std::string mMsg;
+	int mLineNum;
+	int mColNum;
+};
+
+enum class OutputKind
+{
+	Bitcode,
+	Assembly,
+	Object
+};
+
+struct CompileOptions
+{
+	CompileOptions()
+	: mOutput(OutputKind::Bitcode)
+	, mOptimize(false)
+	, mNumColors(0)
+	{ }
+	
+	OutputKind mOutput;
+	// Run the uscc optimization passes
+	bool mOptimize;
+	// Cap on register colors (0 means no cap), for Assembly/Object
+	unsigned long mNumColors;
+};
+
+struct CompileResult
+{
+	CompileResult()
+	: mSuccess(false)
+	{ }
+	
+	bool mSuccess;
+	std::vector<Diagnostic> mDiagnostics;
+	// Bitcode, assembly or object file bytes, depending on
+	// the requested OutputKind
+	std::string mOutput;
+};
+
+// Compiles length bytes of source. name is only used to identify the
+// source in diagnostics.
+CompileResult compile(const char* name, const char* source, size_t length,
+					  const CompileOptions& options = CompileOptions());
+
+} // api
+} // uscc
@@ -0,0 +1,105 @@
+//
+//  ADCE.cpp
+//  uscc
+//
+//  Implements aggressive dead code elimination.
+//  Everything starts out dead, except for instructions with
+//  side effects (stores, calls and terminators). These are
+//  marked live, then so is everything they use, and so on.
+//  Whatever isn't marked at the end is removed, including
+//  phis that only feed each other.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#pragma clang diagnostic pop
+#include <vector>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+bool ADCE::runOnFunction(Function& F)
+{
+	SmallPtrSet<Instruction*, 128> live;
+	SmallVector<Instruction*, 128> worklist;
+
+	// Mark the roots
+	for (auto& BB : F)
+	{
+		for (auto& I : BB)
+		{
+			if (isa<TerminatorInst>(&I) || I.mayHaveSideEffects())
+			{
+				live.insert(&I);
+				worklist.push_back(&I);
+			}
+		}
+	}
+
+	// Anything a live instruction uses is live, too
+	while (!worklist.empty())
+	{
+		Instruction* I = worklist.pop_back_val();
+		for (auto op = I->op_begin(); op != I->op_end(); ++op)
+		{
+			Instruction* opInst = dyn_cast<Instruction>(*op);
+			if (opInst && live.insert(opInst))
+			{
+				worklist.push_back(opInst);
+			}
+		}
+	}
+
+	// Sweep. References are dropped first, since dead
+	// instructions (like phi cycles) can use each other.
+	std::vector<Instruction*> dead;
+	for (auto& BB : F)
+	{
+		for (auto& I : BB)
+		{
+			if (!live.count(&I))
+			{
+				I.dropAllReferences();
+				dead.push_back(&I);
+			}
+		}
+	}
+
+	for (Instruction* I : dead)
+	{
+		I->eraseFromParent();
+	}
+
+	if (OptStatsConfig* stats = getAnalysisIfAvailable<OptStatsConfig>())
+	{
+		stats->count(F, "adce", "instructions removed", static_cast<unsigned>(dead.size()));
+	}
+
+	return !dead.empty();
+}
+
+void ADCE::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// Branches are never removed, so the CFG stays the same
+	Info.setPreservesCFG();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::ADCE::ID = 0;
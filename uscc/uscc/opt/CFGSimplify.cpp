@@ -0,0 +1,533 @@
+//
+//  CFGSimplify.cpp
+//  uscc
+//
+//  Implements CFG simplification. Repeats the following
+//  until none of them apply:
+//     * Removes blocks that can't be reached from the entry
+//     * Threads a predecessor's edge straight to the block's
+//       successor, if the block's branch condition is known
+//       on that edge (such as a phi of constants)
+//     * Removes blocks that only branch to another block
+//     * Merges a block into its predecessor, if it's the
+//       predecessor's only successor and vice versa
+//
+//  The && and || emitters leave lots of chances for all three.
+//
+//  Blocks are taken from a worklist. When one changes, its
+//  neighbors are queued again, since those are the only blocks
+//  the change can open up new chances for.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/DepthFirstIterator.h>
+#include <llvm/IR/ValueHandle.h>
+#pragma clang diagnostic pop
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+// Returns the number of edges from pred to BB
+static unsigned countEdges(BasicBlock* pred, BasicBlock* BB)
+{
+	unsigned count = 0;
+	TerminatorInst* term = pred->getTerminator();
+	for (unsigned i = 0; i < term->getNumSuccessors(); i++)
+	{
+		if (term->getSuccessor(i) == BB)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+// Points pred's edges to from at to instead
+static void redirectEdges(BasicBlock* pred, BasicBlock* from, BasicBlock* to)
+{
+	TerminatorInst* term = pred->getTerminator();
+	for (unsigned i = 0; i < term->getNumSuccessors(); i++)
+	{
+		if (term->getSuccessor(i) == from)
+		{
+			term->setSuccessor(i, to);
+		}
+	}
+}
+
+namespace
+{
+
+// The blocks left to look at. A queued block can be deleted by a change
+// to its neighbor, so they're held by weak handles.
+class Worklist
+{
+public:
+	void push(BasicBlock* BB)
+	{
+		if (BB && mQueued.count(BB) == 0)
+		{
+			mQueued.insert(BB);
+			mBlocks.push_back(WeakVH(BB));
+		}
+	}
+
+	// Returns null once there's nothing left
+	BasicBlock* pop()
+	{
+		while (!mBlocks.empty())
+		{
+			Value* v = mBlocks.back();
+			mBlocks.pop_back();
+			if (BasicBlock* BB = cast_or_null<BasicBlock>(v))
+			{
+				mQueued.erase(BB);
+				return BB;
+			}
+		}
+		// Anything still in mQueued was deleted (and this pass never
+		// makes new blocks, so those addresses won't come back)
+		return nullptr;
+	}
+
+private:
+	std::vector<WeakVH> mBlocks;
+	SmallPtrSet<BasicBlock*, 32> mQueued;
+};
+
+}
+
+// Removes BB if nothing branches to it
+static bool removeUnreachable(BasicBlock* BB)
+{
+	if (BB == &BB->getParent()->getEntryBlock() || pred_begin(BB) != pred_end(BB))
+	{
+		return false;
+	}
+
+	for (auto succ = succ_begin(BB); succ != succ_end(BB); ++succ)
+	{
+		succ->removePredecessor(BB);
+	}
+
+	// Anything still using values from BB is unreachable too
+	for (auto& I : *BB)
+	{
+		if (!I.use_empty())
+		{
+			I.replaceAllUsesWith(UndefValue::get(I.getType()));
+		}
+	}
+	BB->eraseFromParent();
+	return true;
+}
+
+// Removes the blocks that can't be reached from the entry block. Unlike
+// removeUnreachable, this finds dead loops, whose blocks all still have
+// predecessors. The live blocks they branched to are queued on work.
+static unsigned removeDeadBlocks(Function& F, Worklist& work)
+{
+	SmallPtrSet<BasicBlock*, 32> live;
+	for (auto I = df_ext_begin(&F, live), E = df_ext_end(&F, live); I != E; ++I)
+	{
+	}
+	if (live.size() == F.size())
+	{
+		return 0;
+	}
+
+	std::vector<BasicBlock*> dead;
+	for (auto& BB : F)
+	{
+		if (live.count(&BB) == 0)
+		{
+			dead.push_back(&BB);
+		}
+	}
+
+	for (BasicBlock* BB : dead)
+	{
+		for (auto succ = succ_begin(BB); succ != succ_end(BB); ++succ)
+		{
+			if (live.count(*succ))
+			{
+				succ->removePredecessor(BB);
+				work.push(*succ);
+			}
+		}
+	}
+	// The dead blocks can use each other's values, and branch to each
+	// other, so every reference goes before any block is erased
+	for (BasicBlock* BB : dead)
+	{
+		for (auto& I : *BB)
+		{
+			if (!I.use_empty())
+			{
+				I.replaceAllUsesWith(UndefValue::get(I.getType()));
+			}
+		}
+		BB->dropAllReferences();
+	}
+	for (BasicBlock* BB : dead)
+	{
+		BB->eraseFromParent();
+	}
+	return static_cast<unsigned>(dead.size());
+}
+
+// Finds the value of v on the edge from pred into BB, if it's a constant
+// (or computed from constants and phis in BB)
+static Constant* evaluateOnEdge(Value* v, BasicBlock* BB, BasicBlock* pred)
+{
+	if (Constant* c = dyn_cast<Constant>(v))
+	{
+		return c;
+	}
+
+	Instruction* I = dyn_cast<Instruction>(v);
+	if (I == nullptr || I->getParent() != BB)
+	{
+		return nullptr;
+	}
+
+	if (PHINode* phi = dyn_cast<PHINode>(I))
+	{
+		return dyn_cast<Constant>(phi->getIncomingValueForBlock(pred));
+	}
+	else if (CastInst* cast = dyn_cast<CastInst>(I))
+	{
+		Constant* op = evaluateOnEdge(cast->getOperand(0), BB, pred);
+		if (op)
+		{
+			return ConstantExpr::getCast(cast->getOpcode(), op, cast->getType());
+		}
+	}
+	else if (CmpInst* cmp = dyn_cast<CmpInst>(I))
+	{
+		Constant* lhs = evaluateOnEdge(cmp->getOperand(0), BB, pred);
+		Constant* rhs = evaluateOnEdge(cmp->getOperand(1), BB, pred);
+		if (lhs && rhs)
+		{
+			return ConstantExpr::getCompare(cmp->getPredicate(), lhs, rhs);
+		}
+	}
+	else if (BinaryOperator* binOp = dyn_cast<BinaryOperator>(I))
+	{
+		Constant* lhs = evaluateOnEdge(binOp->getOperand(0), BB, pred);
+		Constant* rhs = evaluateOnEdge(binOp->getOperand(1), BB, pred);
+		if (lhs && rhs)
+		{
+			return ConstantExpr::get(binOp->getOpcode(), lhs, rhs);
+		}
+	}
+
+	return nullptr;
+}
+
+// Returns the value a phi in succ (a successor of BB) would get from pred,
+// if pred branched to succ instead of BB. Null if it's defined in BB and
+// wouldn't be available.
+static Value* valueForThreadedEdge(PHINode* succPhi, BasicBlock* BB, BasicBlock* pred)
+{
+	Value* v = succPhi->getIncomingValueForBlock(BB);
+	Instruction* I = dyn_cast<Instruction>(v);
+	if (I == nullptr || I->getParent() != BB)
+	{
+		return v;
+	}
+	if (PHINode* phi = dyn_cast<PHINode>(I))
+	{
+		return phi->getIncomingValueForBlock(pred);
+	}
+	return nullptr;
+}
+
+// If BB's branch condition is known on the edge from one of its
+// predecessors, jump from that predecessor straight to the target.
+// BB can only be skipped if it has no side effects, and nothing
+// it defines is needed elsewhere.
+static bool threadBranch(BasicBlock* BB)
+{
+	BranchInst* br = dyn_cast<BranchInst>(BB->getTerminator());
+	if (br == nullptr || br->isUnconditional())
+	{
+		return false;
+	}
+
+	for (auto& I : *BB)
+	{
+		if (&I == br)
+		{
+			continue;
+		}
+		if (I.mayHaveSideEffects())
+		{
+			return false;
+		}
+		// Outside of BB, it can only be used by phis, on edges from BB
+		for (auto use = I.use_begin(); use != I.use_end(); ++use)
+		{
+			Instruction* userInst = cast<Instruction>(use->getUser());
+			if (userInst->getParent() == BB)
+			{
+				continue;
+			}
+			PHINode* phi = dyn_cast<PHINode>(userInst);
+			if (phi == nullptr || phi->getIncomingBlock(*use) != BB)
+			{
+				return false;
+			}
+		}
+	}
+
+	SmallPtrSet<BasicBlock*, 8> preds;
+	for (auto pred = pred_begin(BB); pred != pred_end(BB); ++pred)
+	{
+		preds.insert(*pred);
+	}
+
+	for (BasicBlock* pred : preds)
+	{
+		if (pred == BB || countEdges(pred, BB) != 1)
+		{
+			continue;
+		}
+
+		ConstantInt* cond = dyn_cast_or_null<ConstantInt>(
+			evaluateOnEdge(br->getCondition(), BB, pred));
+		if (cond == nullptr)
+		{
+			continue;
+		}
+		BasicBlock* target = br->getSuccessor(cond->isZero() ? 1 : 0);
+
+		// Work out what the target's phis get from pred
+		SmallVector<std::pair<PHINode*, Value*>, 8> incoming;
+		bool canThread = target != BB;
+		for (auto I = target->begin(); canThread && isa<PHINode>(I); ++I)
+		{
+			PHINode* phi = cast<PHINode>(I);
+			Value* v = valueForThreadedEdge(phi, BB, pred);
+			if (v == nullptr || phi->getBasicBlockIndex(pred) != -1)
+			{
+				canThread = false;
+			}
+			incoming.push_back(std::make_pair(phi, v));
+		}
+		if (!canThread)
+		{
+			continue;
+		}
+
+		for (auto& p : incoming)
+		{
+			p.first->addIncoming(p.second, pred);
+		}
+		redirectEdges(pred, BB, target);
+		BB->removePredecessor(pred);
+		return true;
+	}
+
+	return false;
+}
+
+// If BB only branches somewhere else, point its predecessors there
+static bool removeForwardingBlock(BasicBlock* BB)
+{
+	BranchInst* br = dyn_cast<BranchInst>(&BB->front());
+	if (br == nullptr || br->isConditional() ||
+		BB == &BB->getParent()->getEntryBlock())
+	{
+		return false;
+	}
+
+	BasicBlock* succ = br->getSuccessor(0);
+	if (succ == BB)
+	{
+		return false;
+	}
+
+	// One entry per edge, since that's what succ's phis need
+	SmallVector<BasicBlock*, 8> preds(pred_begin(BB), pred_end(BB));
+
+	// If a predecessor already goes to succ, its phis can't tell the edges apart
+	if (PHINode* phi = dyn_cast<PHINode>(&succ->front()))
+	{
+		for (BasicBlock* pred : preds)
+		{
+			if (phi->getBasicBlockIndex(pred) != -1)
+			{
+				return false;
+			}
+		}
+	}
+
+	for (auto I = succ->begin(); isa<PHINode>(I); ++I)
+	{
+		PHINode* phi = cast<PHINode>(I);
+		Value* v = phi->getIncomingValueForBlock(BB);
+		phi->removeIncomingValue(BB, false);
+		for (BasicBlock* pred : preds)
+		{
+			phi->addIncoming(v, pred);
+		}
+	}
+
+	for (BasicBlock* pred : preds)
+	{
+		redirectEdges(pred, BB, succ);
+	}
+
+	BB->eraseFromParent();
+	return true;
+}
+
+// If BB is the only predecessor of its only successor, merge the two
+static bool mergeSuccessor(BasicBlock* BB)
+{
+	BranchInst* br = dyn_cast<BranchInst>(BB->getTerminator());
+	if (br == nullptr || br->isConditional())
+	{
+		return false;
+	}
+
+	BasicBlock* succ = br->getSuccessor(0);
+	if (succ == BB || succ->getSinglePredecessor() != BB)
+	{
+		return false;
+	}
+
+	// With one predecessor, the phis are just copies
+	while (PHINode* phi = dyn_cast<PHINode>(&succ->front()))
+	{
+		phi->replaceAllUsesWith(phi->getIncomingValue(0));
+		phi->eraseFromParent();
+	}
+
+	br->eraseFromParent();
+	// This also makes phis in succ's successors refer to BB
+	succ->replaceAllUsesWith(BB);
+	BB->getInstList().splice(BB->end(), succ->getInstList());
+	succ->eraseFromParent();
+	return true;
+}
+
+bool CFGSimplify::runOnFunction(Function& F)
+{
+	// How many times each simplification was done
+	unsigned removed = 0;
+	unsigned threaded = 0;
+	unsigned forwarded = 0;
+	unsigned merged = 0;
+
+	Worklist work;
+	for (auto& BB : F)
+	{
+		work.push(&BB);
+	}
+
+	while (true)
+	{
+		while (BasicBlock* BB = work.pop())
+		{
+			// A change to BB can only open up new ones for BB and its
+			// neighbors (any of which it may delete)
+			std::vector<WeakVH> affected;
+			affected.push_back(WeakVH(BB));
+			for (auto pred = pred_begin(BB); pred != pred_end(BB); ++pred)
+			{
+				affected.push_back(WeakVH(*pred));
+			}
+			for (auto succ = succ_begin(BB); succ != succ_end(BB); ++succ)
+			{
+				affected.push_back(WeakVH(*succ));
+			}
+
+			if (removeUnreachable(BB))
+			{
+				removed++;
+			}
+			else if (threadBranch(BB))
+			{
+				threaded++;
+			}
+			else if (removeForwardingBlock(BB))
+			{
+				forwarded++;
+			}
+			else if (mergeSuccessor(BB))
+			{
+				merged++;
+			}
+			else
+			{
+				continue;
+			}
+
+			for (auto& handle : affected)
+			{
+				Value* v = handle;
+				work.push(cast_or_null<BasicBlock>(v));
+			}
+			// After a merge, BB has its old successor's successors
+			Value* v = affected[0];
+			if (BasicBlock* changed = cast_or_null<BasicBlock>(v))
+			{
+				for (auto succ = succ_begin(changed); succ != succ_end(changed); ++succ)
+				{
+					work.push(*succ);
+				}
+			}
+		}
+
+		// Finding dead loops takes a walk of the whole CFG, so it's
+		// only done once the worklist runs out (and refills it)
+		unsigned dead = removeDeadBlocks(F, work);
+		if (dead == 0)
+		{
+			break;
+		}
+		removed += dead;
+	}
+
+	if (OptStatsConfig* stats = getAnalysisIfAvailable<OptStatsConfig>())
+	{
+		stats->count(F, "cfgsimplify", "unreachable blocks removed", removed);
+		stats->count(F, "cfgsimplify", "branches threaded", threaded);
+		stats->count(F, "cfgsimplify", "forwarding blocks removed", forwarded);
+		stats->count(F, "cfgsimplify", "blocks merged", merged);
+	}
+
+	return removed + threaded + forwarded + merged > 0;
+}
+
+void CFGSimplify::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// This changes the CFG, so nothing is preserved
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::CFGSimplify::ID = 0;
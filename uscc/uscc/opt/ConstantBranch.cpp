@@ -49,6 +49,11 @@ bool ConstantBranch::runOnFunction(Function& F)
 		}
 	}
 
+	if (OptStatsConfig* stats = getAnalysisIfAvailable<OptStatsConfig>()) {
+		stats->count(F, "constbr", "branches folded",
+					 static_cast<unsigned>(removeSet.size()));
+	}
+
 	for (auto& br : removeSet) {
 		auto cond = dyn_cast<ConstantInt>(br->getCondition())->getValue().getBoolValue();
 		auto brParent = br->getParent();
@@ -72,7 +77,8 @@ bool ConstantBranch::runOnFunction(Function& F)
 void ConstantBranch::getAnalysisUsage(AnalysisUsage& Info) const
 {
 	// PA5
-	Info.addRequired<ConstantOps>(); 
+	// Nothing is preserved, since this changes the CFG. (The passes
+	// this depends on are scheduled by the pipeline; see Pipeline.cpp)
 }
 	
 } // opt
@@ -135,6 +135,12 @@ bool ConstantOps::runOnFunction(Function& F) {
 		++blockIter;
 	}
 	
+	if (OptStatsConfig* stats = getAnalysisIfAvailable<OptStatsConfig>())
+	{
+		stats->count(F, "constops", "instructions folded",
+					 static_cast<unsigned>(removeSet.size()));
+	}
+	
 	// Now remove any instructions we flagged
 	if (removeSet.size() > 0)
 	{
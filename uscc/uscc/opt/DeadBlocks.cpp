@@ -48,6 +48,11 @@ bool DeadBlocks::runOnFunction(Function& F)
 		}
 	}
 
+	if (OptStatsConfig* stats = getAnalysisIfAvailable<OptStatsConfig>()) {
+		stats->count(F, "deadblocks", "blocks removed",
+					 static_cast<unsigned>(unreachableBlock.size()));
+	}
+
 	for (auto BB : unreachableBlock) {
 		auto begin_iter = succ_begin(BB);
 		auto end_iter = succ_end(BB);
@@ -64,7 +69,8 @@ bool DeadBlocks::runOnFunction(Function& F)
 void DeadBlocks::getAnalysisUsage(AnalysisUsage& Info) const
 {
 	// PA5
-	Info.addRequired<ConstantBranch>(); 
+	// Nothing is preserved, since this changes the CFG. (The passes
+	// this depends on are scheduled by the pipeline; see Pipeline.cpp)
 }
 
 } // opt
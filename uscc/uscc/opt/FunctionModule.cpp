@@ -0,0 +1,264 @@
+//
+//  FunctionModule.cpp
+//  uscc
+//
+//  Implements moving single functions between modules
+//  (which may be in different LLVMContexts) via bitcode.
+//
+//  Functions are spliced into the destination module rather
+//  than linked, because string constants are private ".str"
+//  globals whose names depend on the rest of the file.
+//  Instead, private globals are matched up by their initializer.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#include "FunctionModule.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#pragma clang diagnostic pop
+#include <memory>
+#include <unordered_map>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+// Adds the globals used by c (directly, or through constant expressions)
+static void collectGlobals(const Constant* c,
+						   SmallPtrSet<const GlobalValue*, 16>& used)
+{
+	if (const GlobalValue* gv = dyn_cast<GlobalValue>(c))
+	{
+		used.insert(gv);
+	}
+	else
+	{
+		for (auto op = c->op_begin(); op != c->op_end(); ++op)
+		{
+			collectGlobals(cast<Constant>(*op), used);
+		}
+	}
+}
+
+std::string extractFunction(const Function* func)
+{
+	// Find everything func refers to
+	SmallPtrSet<const GlobalValue*, 16> used;
+	used.insert(func);
+	for (auto bb = func->begin(); bb != func->end(); ++bb)
+	{
+		for (auto i = bb->begin(); i != bb->end(); ++i)
+		{
+			for (auto op = i->op_begin(); op != i->op_end(); ++op)
+			{
+				if (const Constant* c = dyn_cast<Constant>(*op))
+				{
+					collectGlobals(c, used);
+				}
+			}
+		}
+	}
+	
+	// Build a module with func, and declarations of those
+	const Module* src = func->getParent();
+	Module cached(src->getModuleIdentifier(), func->getContext());
+	ValueToValueMapTy vmap;
+	
+	// Line tables (-g) are dropped when reading bitcode without this
+	if (Value* version = src->getModuleFlag("Debug Info Version"))
+	{
+		cached.addModuleFlag(Module::Warning, "Debug Info Version",
+							 cast<ConstantInt>(version)->getZExtValue());
+	}
+	
+	for (auto gv = src->global_begin(); gv != src->global_end(); ++gv)
+	{
+		if (!used.count(gv))
+		{
+			continue;
+		}
+		GlobalVariable* copy = new GlobalVariable(cached, gv->getType()->getElementType(),
+												  gv->isConstant(), gv->getLinkage(),
+												  gv->hasInitializer() ? gv->getInitializer() : nullptr,
+												  gv->getName());
+		copy->copyAttributesFrom(gv);
+		vmap[gv] = copy;
+	}
+	
+	for (auto& f : *src)
+	{
+		if (!used.count(&f))
+		{
+			continue;
+		}
+		// Everything but func is a declaration, so has to be external
+		GlobalValue::LinkageTypes linkage = (&f == func) ?
+			f.getLinkage() : GlobalValue::ExternalLinkage;
+		Function* copy = Function::Create(f.getFunctionType(), linkage,
+										  f.getName(), &cached);
+		copy->copyAttributesFrom(&f);
+		vmap[&f] = copy;
+	}
+	
+	Function* copy = cached.getFunction(func->getName());
+	auto destArg = copy->arg_begin();
+	for (auto arg = func->arg_begin(); arg != func->arg_end(); ++arg)
+	{
+		destArg->setName(arg->getName());
+		vmap[arg] = destArg;
+		++destArg;
+	}
+	
+	SmallVector<ReturnInst*, 8> returns;
+	CloneFunctionInto(copy, func, vmap, true, returns);
+	
+	std::string bitcode;
+	raw_string_ostream out(bitcode);
+	WriteBitcodeToFile(&cached, out);
+	out.flush();
+	return bitcode;
+}
+
+bool spliceFunction(const std::string& bitcode, Function* dest)
+{
+	std::unique_ptr<MemoryBuffer> buffer(MemoryBuffer::getMemBuffer(bitcode, "", false));
+	ErrorOr<Module*> result = parseBitcodeFile(buffer.get(), dest->getContext());
+	if (!result)
+	{
+		return false;
+	}
+	std::unique_ptr<Module> cached(result.get());
+	
+	Function* src = cached->getFunction(dest->getName());
+	if (!src || src->isDeclaration() || src->getType() != dest->getType())
+	{
+		return false;
+	}
+	
+	// Match every global the cached function could reference
+	// with the one in the module we're compiling
+	Module* destMod = dest->getParent();
+	std::unordered_map<Constant*, GlobalVariable*> destGlobals;
+	for (auto gv = destMod->global_begin(); gv != destMod->global_end(); ++gv)
+	{
+		if (gv->hasInitializer())
+		{
+			destGlobals[gv->getInitializer()] = gv;
+		}
+	}
+	
+	std::vector<std::pair<GlobalValue*, GlobalValue*>> remap;
+	std::vector<GlobalVariable*> missing;
+	for (auto gv = cached->global_begin(); gv != cached->global_end(); ++gv)
+	{
+		if (!gv->hasInitializer())
+		{
+			return false;
+		}
+		// Only private globals (the strings) are renamed between
+		// modules; anything else, such as profile counters, keeps its name
+		GlobalVariable* match = gv->hasPrivateLinkage() ?
+			destGlobals[gv->getInitializer()] : destMod->getNamedGlobal(gv->getName());
+		if (!match)
+		{
+			// Strings are only emitted once used, so this
+			// function may be the first to use it
+			missing.push_back(gv);
+		}
+		else if (match->getType() != gv->getType())
+		{
+			return false;
+		}
+		else
+		{
+			remap.push_back(std::make_pair(gv, match));
+		}
+	}
+	
+	std::vector<Function*> missingFuncs;
+	for (auto& f : *cached)
+	{
+		if (&f == src)
+		{
+			continue;
+		}
+		Function* match = destMod->getFunction(f.getName());
+		if (!match && f.isDeclaration())
+		{
+			// Passes can call library functions the module didn't
+			// use before (such as puts, from the printf pass)
+			missingFuncs.push_back(&f);
+		}
+		else if (!match || match->getType() != f.getType())
+		{
+			return false;
+		}
+		else
+		{
+			remap.push_back(std::make_pair(&f, match));
+		}
+	}
+	
+	// Everything matches up, so replace the body
+	if (!dest->isDeclaration())
+	{
+		// deleteBody makes the function external, which isn't wanted here
+		GlobalValue::LinkageTypes linkage = dest->getLinkage();
+		dest->deleteBody();
+		dest->setLinkage(linkage);
+	}
+	for (GlobalVariable* gv : missing)
+	{
+		GlobalVariable* copy = new GlobalVariable(*destMod, gv->getType()->getElementType(),
+												  gv->isConstant(), gv->getLinkage(),
+												  gv->getInitializer(), gv->getName());
+		copy->copyAttributesFrom(gv);
+		remap.push_back(std::make_pair(gv, copy));
+	}
+	for (Function* f : missingFuncs)
+	{
+		Function* copy = Function::Create(f->getFunctionType(), f->getLinkage(),
+										  f->getName(), destMod);
+		copy->copyAttributesFrom(f);
+		remap.push_back(std::make_pair(f, copy));
+	}
+	
+	auto destArg = dest->arg_begin();
+	for (auto arg = src->arg_begin(); arg != src->arg_end(); ++arg)
+	{
+		arg->replaceAllUsesWith(destArg);
+		destArg->takeName(arg);
+		++destArg;
+	}
+	dest->getBasicBlockList().splice(dest->end(), src->getBasicBlockList());
+	
+	// Self references (recursion) still point at src
+	src->replaceAllUsesWith(dest);
+	for (auto& p : remap)
+	{
+		p.first->replaceAllUsesWith(p.second);
+	}
+	
+	return true;
+}
+} // opt
+} // uscc
@@ -0,0 +1,39 @@
+//
+//  FunctionModule.h
+//  uscc
+//
+//  Declares helpers to move single functions between
+//  modules via bitcode. Used by the IR cache, and to hand
+//  functions to other threads (each with its own LLVMContext).
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#pragma once
+#include <string>
+
+namespace llvm
+{
+	class Function;
+}
+
+namespace uscc
+{
+namespace opt
+{
+
+// Returns bitcode for a module holding a copy of func, plus
+// declarations of the functions and globals it refers to
+std::string extractFunction(const llvm::Function* func);
+
+// Replaces the body of dest (which may be a declaration) with the function
+// of the same name in bitcode, which must have been made by extractFunction.
+// Returns false, leaving dest untouched, if the bitcode doesn't match up.
+bool spliceFunction(const std::string& bitcode, llvm::Function* dest);
+
+} // opt
+} // uscc
@@ -0,0 +1,118 @@
+//
+//  IRCache.cpp
+//  uscc
+//
+//  Implements the per-function IR cache.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#include "IRCache.h"
+#include "FunctionModule.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/ADT/SmallString.h>
+#include <llvm/IR/Function.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#pragma clang diagnostic pop
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <iomanip>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+// Identifies this build of uscc, since a different build may emit or
+// optimize the same function differently. It's the size and modification
+// time of the executable (or, if that can't be found, when this file was
+// compiled).
+static std::string getBuildId()
+{
+	static int anchor;
+	std::string exe = sys::fs::getMainExecutable(nullptr, &anchor);
+	sys::fs::file_status status;
+	std::ostringstream ss;
+	ss << std::hex;
+	if (!exe.empty() && !sys::fs::status(exe, status))
+	{
+		ss << status.getSize() << '.' << status.getLastModificationTime().toEpochTime();
+	}
+	else
+	{
+		ss << std::hash<std::string>()(__DATE__ " " __TIME__);
+	}
+	return ss.str();
+}
+
+IRCache::IRCache(const std::string& dir, const std::string& tag)
+: mDir(dir)
+, mTag(tag + "-" + getBuildId())
+{
+	sys::fs::create_directories(mDir);
+}
+
+std::string IRCache::getPath(uint64_t fingerprint) const
+{
+	std::ostringstream ss;
+	ss << mDir << '/' << std::hex << std::setw(16) << std::setfill('0')
+		<< fingerprint << '-' << mTag << ".bc";
+	return ss.str();
+}
+
+bool IRCache::load(uint64_t fingerprint, Function* decl)
+{
+	std::ifstream file(getPath(fingerprint), std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	std::string contents((std::istreambuf_iterator<char>(file)),
+						 std::istreambuf_iterator<char>());
+	
+	return spliceFunction(contents, decl);
+}
+
+void IRCache::store(uint64_t fingerprint, const Function* func)
+{
+	std::string bitcode = extractFunction(func);
+	
+	// Write to a temporary and rename it into place, so a concurrent
+	// compile never sees a partial entry. Each writer gets its own
+	// temporary, in case another compile is storing the same entry.
+	std::string path = getPath(fingerprint);
+	int fd;
+	SmallString<128> tmpPath;
+	if (sys::fs::createUniqueFile(path + ".%%%%%%%%.tmp", fd, tmpPath))
+	{
+		return;
+	}
+	{
+		raw_fd_ostream out(fd, true);
+		out << bitcode;
+		out.close();
+		if (out.has_error())
+		{
+			out.clear_error();
+			sys::fs::remove(tmpPath.str());
+			return;
+		}
+	}
+	if (sys::fs::rename(tmpPath.str(), path))
+	{
+		sys::fs::remove(tmpPath.str());
+	}
+}
+
+} // opt
+} // uscc
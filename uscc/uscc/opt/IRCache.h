@@ -0,0 +1,55 @@
+//
+//  IRCache.h
+//  uscc
+//
+//  Declares the per-function IR cache used for incremental
+//  compilation. Each entry is a bitcode file holding one
+//  function (plus declarations of what it references), named
+//  after the function's fingerprint.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace llvm
+{
+	class Function;
+}
+
+namespace uscc
+{
+namespace opt
+{
+
+class IRCache
+{
+public:
+	// tag distinguishes entries made with different settings
+	// (such as with/without optimization) in the same directory.
+	// Entries are also kept apart by which build of uscc made them.
+	IRCache(const std::string& dir, const std::string& tag);
+	
+	// If there's an entry for this fingerprint, moves its body
+	// into decl (which must be a declaration with a matching type)
+	// and returns true. Otherwise decl is left untouched.
+	bool load(uint64_t fingerprint, llvm::Function* decl);
+	
+	// Writes a copy of func to the cache
+	void store(uint64_t fingerprint, const llvm::Function* func);
+	
+private:
+	std::string getPath(uint64_t fingerprint) const;
+	
+	std::string mDir;
+	std::string mTag;
+};
+
+} // opt
+} // uscc
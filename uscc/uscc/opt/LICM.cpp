@@ -34,6 +34,11 @@ bool LICM::runOnLoop(llvm::Loop *L, llvm::LPPassManager &LPM)
 	
 	// PA5 
 
+	// Without a preheader, there's nowhere to hoist to
+	if (L->getLoopPreheader() == nullptr) {
+		return false;
+	}
+
 	// Save the current loop
 	mCurrLoop = L;
 	// Grab the loop info
@@ -68,6 +73,10 @@ bool LICM::isSafeToHoistInstr(llvm::Instruction* I) {
 void LICM::hoistInstr(llvm::Instruction* I) {
 	I->moveBefore(mCurrLoop->getLoopPreheader()->getTerminator());
 	mChanged = true;
+	
+	if (OptStatsConfig* stats = getAnalysisIfAvailable<OptStatsConfig>()) {
+		stats->count(*I->getParent()->getParent(), "licm", "instructions hoisted", 1);
+	}
 }
 
 void LICM::hoistPreOrder(llvm::DomTreeNode* domNode) {
@@ -95,8 +104,8 @@ void LICM::getAnalysisUsage(AnalysisUsage &Info) const
 
 	// LICM does not modify the CFG
 	Info.setPreservesCFG();
-	// Execute after dead blocks have been removed
-	Info.addRequired<DeadBlocks>();
+	// Dead blocks have already been removed, since deadblocks comes
+	// first in the default pipeline
 	// Use the built-in Dominator tree and loop info passes
 	Info.addRequired<DominatorTreeWrapperPass>();
 	Info.addRequired<LoopInfo>(); 
@@ -0,0 +1,587 @@
+//
+//  LoopUnroll.cpp
+//  uscc
+//
+//  Implements loop unrolling for the loops ASTWhileStmt makes:
+//  the header tests the condition, and exits the loop if it's
+//  false, and the body jumps back to the header from a single
+//  latch.
+//
+//  If the induction variable counts from a constant to a
+//  constant, the loop is fully unrolled (if it's small enough).
+//  Otherwise, if the trip count can be worked out when the loop
+//  is entered (i < n with ++i, or i > n with --i), a copy of the
+//  loop runs the body several times per test, and the original
+//  loop runs whatever iterations are left over.
+//
+//  With a profile (--profile-use), loops that average fewer
+//  iterations each time they're entered than the unroll factor
+//  aren't partially unrolled, since the original loop would end
+//  up doing all the work anyway.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/ValueHandle.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/Local.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#pragma clang diagnostic pop
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+// Most iterations a loop is fully unrolled for
+static const unsigned MAX_FULL_TRIPS = 16;
+// Most instructions the unrolled copies of a loop can add up to
+static const unsigned MAX_UNROLLED_SIZE = 400;
+// Marks the header branch of a loop left over from partial unrolling,
+// so running the pass again (in a pipeline group) leaves it alone
+static const char* UNROLLED_KIND = "uscc.unrolled";
+
+// The parts of a loop that unrolling needs
+struct LoopShape
+{
+	BasicBlock* mPreheader;
+	BasicBlock* mHeader;
+	BasicBlock* mLatch;
+	// First block of the body, and the block the loop exits to
+	BasicBlock* mBody;
+	BasicBlock* mExit;
+	// Induction variable (a phi in the header) and how much it
+	// changes each iteration
+	PHINode* mIndVar;
+	ConstantInt* mStep;
+	// The loop keeps going while "mIndVar mPred mLimit"
+	CmpInst::Predicate mPred;
+	Value* mLimit;
+	// Number of instructions in the loop
+	unsigned mSize;
+};
+
+// Fills in shape if L looks like a while loop with a counter.
+// Returns false if it doesn't.
+static bool analyzeLoop(Loop* L, LoopShape& shape)
+{
+	shape.mPreheader = L->getLoopPreheader();
+	shape.mHeader = L->getHeader();
+	shape.mLatch = L->getLoopLatch();
+	if (!shape.mPreheader || !shape.mLatch || shape.mLatch == shape.mHeader ||
+		L->getExitingBlock() != shape.mHeader || !L->getExitBlock())
+	{
+		return false;
+	}
+	shape.mExit = L->getExitBlock();
+
+	BranchInst* br = dyn_cast<BranchInst>(shape.mHeader->getTerminator());
+	if (!br || br->isUnconditional() || br->getMetadata(UNROLLED_KIND))
+	{
+		return false;
+	}
+	ICmpInst* cmp = dyn_cast<ICmpInst>(br->getCondition());
+	if (!cmp)
+	{
+		return false;
+	}
+	bool exitOnTrue = !L->contains(br->getSuccessor(0));
+	shape.mBody = br->getSuccessor(exitOnTrue ? 1 : 0);
+
+	// Look for "phi op limit" or "limit op phi"
+	CmpInst::Predicate pred = cmp->getPredicate();
+	PHINode* phi = dyn_cast<PHINode>(cmp->getOperand(0));
+	shape.mLimit = cmp->getOperand(1);
+	if (!phi || phi->getParent() != shape.mHeader)
+	{
+		phi = dyn_cast<PHINode>(cmp->getOperand(1));
+		shape.mLimit = cmp->getOperand(0);
+		pred = CmpInst::getSwappedPredicate(pred);
+	}
+	if (!phi || phi->getParent() != shape.mHeader || !L->isLoopInvariant(shape.mLimit))
+	{
+		return false;
+	}
+	shape.mPred = exitOnTrue ? CmpInst::getInversePredicate(pred) : pred;
+	shape.mIndVar = phi;
+
+	// The phi has to go up or down by a constant each time (++i or --i)
+	BinaryOperator* update = dyn_cast<BinaryOperator>(
+		phi->getIncomingValueForBlock(shape.mLatch));
+	if (!update || update->getOperand(0) != phi)
+	{
+		return false;
+	}
+	ConstantInt* step = dyn_cast<ConstantInt>(update->getOperand(1));
+	if (!step || step->isZero())
+	{
+		return false;
+	}
+	if (update->getOpcode() == Instruction::Add)
+	{
+		shape.mStep = step;
+	}
+	else if (update->getOpcode() == Instruction::Sub)
+	{
+		shape.mStep = cast<ConstantInt>(ConstantExpr::getNeg(step));
+	}
+	else
+	{
+		return false;
+	}
+
+	shape.mSize = 0;
+	for (auto BB : L->getBlocks())
+	{
+		shape.mSize += BB->size();
+	}
+
+	return true;
+}
+
+// Returns the number of iterations if it's known and at most MAX_FULL_TRIPS,
+// or -1 otherwise
+static int constantTripCount(const LoopShape& shape)
+{
+	ConstantInt* start = dyn_cast<ConstantInt>(
+		shape.mIndVar->getIncomingValueForBlock(shape.mPreheader));
+	ConstantInt* limit = dyn_cast<ConstantInt>(shape.mLimit);
+	if (!start || !limit)
+	{
+		return -1;
+	}
+
+	// Just run the loop
+	Constant* i = start;
+	for (unsigned trips = 0; trips <= MAX_FULL_TRIPS; trips++)
+	{
+		if (ConstantExpr::getICmp(shape.mPred, i, limit)->isNullValue())
+		{
+			return static_cast<int>(trips);
+		}
+		i = ConstantExpr::getAdd(i, shape.mStep);
+	}
+	return -1;
+}
+
+static Value* mapValue(Value* v, ValueToValueMapTy& vmap)
+{
+	auto iter = vmap.find(v);
+	return iter != vmap.end() ? static_cast<Value*>(iter->second) : v;
+}
+
+// Copies the header's instructions into iter (after any phis already there)
+// using the phi values in vmap
+static void cloneHeader(const LoopShape& shape, BasicBlock* iter, ValueToValueMapTy& vmap)
+{
+	for (auto& I : *shape.mHeader)
+	{
+		if (isa<PHINode>(&I) || &I == shape.mHeader->getTerminator())
+		{
+			continue;
+		}
+		Instruction* copy = I.clone();
+		copy->setName(I.getName());
+		iter->getInstList().push_back(copy);
+		vmap[&I] = copy;
+		RemapInstruction(copy, vmap, RF_NoModuleLevelChanges | RF_IgnoreMissingEntries);
+	}
+}
+
+// Adds the copy of the header's condition in iter to dead, since the
+// copies don't test it. It's removed once the unrolling is done.
+static void addDeadCondition(const LoopShape& shape, BasicBlock* iter,
+							 ValueToValueMapTy& vmap, std::vector<WeakVH>& dead)
+{
+	Instruction* cond = dyn_cast<Instruction>(
+		mapValue(cast<BranchInst>(shape.mHeader->getTerminator())->getCondition(), vmap));
+	if (cond && cond->getParent() == iter)
+	{
+		dead.push_back(WeakVH(cond));
+	}
+}
+
+static void removeDeadConditions(std::vector<WeakVH>& dead)
+{
+	for (auto& handle : dead)
+	{
+		Value* v = handle;
+		if (Instruction* I = cast_or_null<Instruction>(v))
+		{
+			RecursivelyDeleteTriviallyDeadInstructions(I);
+		}
+	}
+}
+
+// Makes one copy of the loop, starting at iter, which must already be
+// in vmap as the header. vmap has the header phis' values for this
+// iteration. The copy's latch is returned, still branching to iter.
+static BasicBlock* cloneIteration(Loop* L, const LoopShape& shape, BasicBlock* iter,
+								  ValueToValueMapTy& vmap, const std::string& suffix,
+								  std::vector<WeakVH>& dead)
+{
+	Function* F = shape.mHeader->getParent();
+
+	cloneHeader(shape, iter, vmap);
+
+	std::vector<BasicBlock*> blocks;
+	for (auto BB : L->getBlocks())
+	{
+		if (BB != shape.mHeader)
+		{
+			BasicBlock* copy = CloneBasicBlock(BB, vmap, suffix, F);
+			vmap[BB] = copy;
+			blocks.push_back(copy);
+		}
+	}
+	for (auto BB : blocks)
+	{
+		for (auto& I : *BB)
+		{
+			RemapInstruction(&I, vmap, RF_NoModuleLevelChanges | RF_IgnoreMissingEntries);
+		}
+	}
+
+	// The header's test is known to pass
+	BranchInst::Create(cast<BasicBlock>(vmap[shape.mBody]), iter);
+	addDeadCondition(shape, iter, vmap, dead);
+
+	return cast<BasicBlock>(vmap[shape.mLatch]);
+}
+
+// Points the latch copy at the next iteration
+static void linkLatch(BasicBlock* latch, BasicBlock* from, BasicBlock* to)
+{
+	TerminatorInst* term = latch->getTerminator();
+	for (unsigned i = 0; i < term->getNumSuccessors(); i++)
+	{
+		if (term->getSuccessor(i) == from)
+		{
+			term->setSuccessor(i, to);
+		}
+	}
+}
+
+// Replaces the loop with trips copies of its body
+static void unrollFully(Loop* L, const LoopShape& shape, unsigned trips)
+{
+	LLVMContext& ctx = shape.mHeader->getContext();
+	Function* F = shape.mHeader->getParent();
+
+	// Values of the header phis for the current iteration
+	ValueToValueMapTy vmap;
+	for (auto I = shape.mHeader->begin(); isa<PHINode>(I); ++I)
+	{
+		PHINode* phi = cast<PHINode>(I);
+		vmap[phi] = phi->getIncomingValueForBlock(shape.mPreheader);
+	}
+
+	std::vector<WeakVH> dead;
+	BasicBlock* first = nullptr;
+	BasicBlock* prevLatch = nullptr;
+	BasicBlock* prevIter = nullptr;
+	for (unsigned i = 0; i <= trips; i++)
+	{
+		std::string suffix = ".u" + std::to_string(i);
+		BasicBlock* iter = BasicBlock::Create(ctx, shape.mHeader->getName() + suffix, F);
+		if (prevLatch)
+		{
+			linkLatch(prevLatch, prevIter, iter);
+		}
+		else
+		{
+			first = iter;
+		}
+		if (i == trips)
+		{
+			// The last test fails, so this just has what the header
+			// computes on the way out of the loop
+			vmap[shape.mHeader] = iter;
+			cloneHeader(shape, iter, vmap);
+			BranchInst::Create(shape.mExit, iter);
+			addDeadCondition(shape, iter, vmap, dead);
+			prevIter = iter;
+			break;
+		}
+
+		vmap[shape.mHeader] = iter;
+		prevLatch = cloneIteration(L, shape, iter, vmap, suffix, dead);
+		prevIter = iter;
+
+		// Work out the phi values for the next iteration
+		ValueToValueMapTy next;
+		for (auto I = shape.mHeader->begin(); isa<PHINode>(I); ++I)
+		{
+			PHINode* phi = cast<PHINode>(I);
+			next[phi] = mapValue(phi->getIncomingValueForBlock(shape.mLatch), vmap);
+		}
+		vmap.clear();
+		for (auto& p : next)
+		{
+			vmap[p.first] = p.second;
+		}
+	}
+	BasicBlock* last = prevIter;
+
+	// Anything outside the loop that used the header's values
+	// now uses the ones from the last copy
+	for (auto I = shape.mExit->begin(); isa<PHINode>(I); ++I)
+	{
+		PHINode* phi = cast<PHINode>(I);
+		for (unsigned i = 0; i < phi->getNumIncomingValues(); i++)
+		{
+			if (phi->getIncomingBlock(i) == shape.mHeader)
+			{
+				phi->setIncomingBlock(i, last);
+			}
+		}
+	}
+	for (auto& I : *shape.mHeader)
+	{
+		Value* replacement = mapValue(&I, vmap);
+		for (auto use = I.use_begin(); use != I.use_end(); )
+		{
+			Use& u = *use;
+			++use;
+			Instruction* user = cast<Instruction>(u.getUser());
+			if (!L->contains(user->getParent()))
+			{
+				u.set(replacement);
+			}
+		}
+	}
+
+	linkLatch(shape.mPreheader, shape.mHeader, first);
+
+	// Nothing reaches the old loop now
+	for (auto BB : L->getBlocks())
+	{
+		BB->dropAllReferences();
+	}
+	std::vector<BasicBlock*> blocks(L->block_begin(), L->block_end());
+	for (auto BB : blocks)
+	{
+		BB->eraseFromParent();
+	}
+
+	removeDeadConditions(dead);
+}
+
+// Adds a copy of the loop that runs factor iterations per test, as many
+// times as it can. The original loop is left to run the rest.
+static void unrollPartially(Loop* L, const LoopShape& shape, unsigned factor)
+{
+	LLVMContext& ctx = shape.mHeader->getContext();
+	Function* F = shape.mHeader->getParent();
+	Type* ty = shape.mIndVar->getType();
+
+	// Work out how many times the unrolled loop runs, in the preheader:
+	//   trips = start < limit ? limit - start : 0  (for i < n with ++i)
+	// The difference is an exact unsigned number, even if it overflows
+	// as a signed one.
+	Value* start = shape.mIndVar->getIncomingValueForBlock(shape.mPreheader);
+	IRBuilder<> build(shape.mPreheader->getTerminator());
+	Value* hasTrips = nullptr;
+	Value* trips = nullptr;
+	if (shape.mPred == CmpInst::ICMP_SLT)
+	{
+		hasTrips = build.CreateICmpSLT(start, shape.mLimit, "unroll.hastrips");
+		trips = build.CreateSub(shape.mLimit, start, "unroll.trips");
+	}
+	else
+	{
+		hasTrips = build.CreateICmpSGT(start, shape.mLimit, "unroll.hastrips");
+		trips = build.CreateSub(start, shape.mLimit, "unroll.trips");
+	}
+	Value* count = build.CreateUDiv(trips, ConstantInt::get(ty, factor), "unroll.count");
+	count = build.CreateSelect(hasTrips, count, ConstantInt::get(ty, 0), "unroll.count");
+	Value* runUnrolled = build.CreateICmpNE(count, ConstantInt::get(ty, 0), "unroll.run");
+
+	BasicBlock* header = BasicBlock::Create(ctx, shape.mHeader->getName() + ".unroll", F);
+	BasicBlock* latch = BasicBlock::Create(ctx, shape.mLatch->getName() + ".unroll", F);
+	BasicBlock* exit = BasicBlock::Create(ctx, shape.mHeader->getName() + ".unroll.end", F);
+
+	shape.mPreheader->getTerminator()->eraseFromParent();
+	BranchInst::Create(header, shape.mHeader, runUnrolled, shape.mPreheader);
+
+	// The unrolled loop gets its own copy of each header phi, plus a counter
+	std::vector<std::pair<PHINode*, PHINode*>> phis;
+	ValueToValueMapTy vmap;
+	for (auto I = shape.mHeader->begin(); isa<PHINode>(I); ++I)
+	{
+		PHINode* phi = cast<PHINode>(I);
+		PHINode* copy = PHINode::Create(phi->getType(), 2, phi->getName() + ".unroll", header);
+		copy->addIncoming(phi->getIncomingValueForBlock(shape.mPreheader), shape.mPreheader);
+		phis.push_back(std::make_pair(phi, copy));
+		vmap[phi] = copy;
+	}
+	PHINode* counter = PHINode::Create(ty, 2, "unroll.iter", header);
+	counter->addIncoming(ConstantInt::get(ty, 0), shape.mPreheader);
+
+	std::vector<WeakVH> dead;
+	BasicBlock* prevLatch = nullptr;
+	BasicBlock* prevIter = nullptr;
+	for (unsigned i = 0; i < factor; i++)
+	{
+		std::string suffix = ".u" + std::to_string(i);
+		BasicBlock* iter = header;
+		if (i > 0)
+		{
+			iter = BasicBlock::Create(ctx, shape.mHeader->getName() + suffix, F);
+			linkLatch(prevLatch, prevIter, iter);
+		}
+
+		vmap[shape.mHeader] = iter;
+		prevLatch = cloneIteration(L, shape, iter, vmap, suffix, dead);
+		prevIter = iter;
+
+		ValueToValueMapTy next;
+		for (auto& p : phis)
+		{
+			next[p.first] = mapValue(p.first->getIncomingValueForBlock(shape.mLatch), vmap);
+		}
+		vmap.clear();
+		for (auto& p : next)
+		{
+			vmap[p.first] = p.second;
+		}
+	}
+	linkLatch(prevLatch, prevIter, latch);
+
+	// Go around again if there are enough iterations left
+	IRBuilder<> latchBuild(latch);
+	Value* nextCounter = latchBuild.CreateAdd(counter, ConstantInt::get(ty, 1), "unroll.next");
+	Value* more = latchBuild.CreateICmpULT(nextCounter, count, "unroll.more");
+	latchBuild.CreateCondBr(more, header, exit);
+	counter->addIncoming(nextCounter, latch);
+
+	// Then the original loop finishes up
+	BranchInst::Create(shape.mHeader, exit);
+	shape.mHeader->getTerminator()->setMetadata(UNROLLED_KIND,
+		MDNode::get(ctx, ArrayRef<Value*>()));
+	for (auto& p : phis)
+	{
+		Value* v = mapValue(p.first, vmap);
+		p.second->addIncoming(v, latch);
+		p.first->addIncoming(v, exit);
+	}
+
+	removeDeadConditions(dead);
+}
+
+// Returns false if the profile weights on the header branch say the
+// loop usually runs fewer than factor times when it's entered
+static bool profileAllowsUnroll(Loop* L, const LoopShape& shape, unsigned factor)
+{
+	BranchInst* br = cast<BranchInst>(shape.mHeader->getTerminator());
+	MDNode* weights = br->getMetadata(LLVMContext::MD_prof);
+	if (!weights || weights->getNumOperands() != 3)
+	{
+		return true;
+	}
+	ConstantInt* first = dyn_cast<ConstantInt>(weights->getOperand(1));
+	ConstantInt* second = dyn_cast<ConstantInt>(weights->getOperand(2));
+	if (!first || !second)
+	{
+		return true;
+	}
+
+	uint64_t stay = first->getZExtValue();
+	uint64_t exit = second->getZExtValue();
+	if (!L->contains(br->getSuccessor(0)))
+	{
+		std::swap(stay, exit);
+	}
+	return stay >= exit * factor;
+}
+
+LoopUnroll::LoopUnroll(unsigned factor)
+: FunctionPass(ID)
+, mFactor(factor)
+{ }
+
+bool LoopUnroll::runOnFunction(Function& F)
+{
+	LoopInfo& loopInfo = getAnalysis<LoopInfo>();
+
+	// Only innermost loops are unrolled. Their blocks don't overlap,
+	// so unrolling one doesn't change the others.
+	std::vector<Loop*> loops;
+	std::vector<Loop*> worklist(loopInfo.begin(), loopInfo.end());
+	while (!worklist.empty())
+	{
+		Loop* L = worklist.back();
+		worklist.pop_back();
+		if (L->empty())
+		{
+			loops.push_back(L);
+		}
+		else
+		{
+			worklist.insert(worklist.end(), L->begin(), L->end());
+		}
+	}
+
+	unsigned full = 0;
+	unsigned partial = 0;
+	for (Loop* L : loops)
+	{
+		LoopShape shape;
+		if (!analyzeLoop(L, shape))
+		{
+			continue;
+		}
+
+		int trips = constantTripCount(shape);
+		if (trips >= 0 && shape.mSize * static_cast<unsigned>(trips) <= MAX_UNROLLED_SIZE)
+		{
+			unrollFully(L, shape, static_cast<unsigned>(trips));
+			full++;
+		}
+		else if (mFactor > 1 && shape.mSize * mFactor <= MAX_UNROLLED_SIZE &&
+				 ((shape.mPred == CmpInst::ICMP_SLT && shape.mStep->isOne()) ||
+				  (shape.mPred == CmpInst::ICMP_SGT && shape.mStep->isAllOnesValue())) &&
+				 ConstantInt::isValueValidForType(shape.mIndVar->getType(), mFactor) &&
+				 profileAllowsUnroll(L, shape, mFactor))
+		{
+			unrollPartially(L, shape, mFactor);
+			partial++;
+		}
+	}
+
+	if (OptStatsConfig* stats = getAnalysisIfAvailable<OptStatsConfig>())
+	{
+		stats->count(F, "unroll", "loops fully unrolled", full);
+		stats->count(F, "unroll", "loops partially unrolled", partial);
+	}
+
+	return full + partial > 0;
+}
+
+void LoopUnroll::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	Info.addRequired<LoopInfo>();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::LoopUnroll::ID = 0;
@@ -0,0 +1,232 @@
+//
+//  MemReport.cpp
+//  uscc
+//
+//  Implements the memory accounting for --mem-report.
+//
+//  Each counted allocation is remembered (with its size and
+//  tag) in a table that allocates with malloc, so that the
+//  hooks don't call back into themselves. Frees of pointers that
+//  aren't in the table were allocated before counting started,
+//  and are ignored.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "MemReport.h"
+#include <cstdlib>
+#include <iomanip>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+
+namespace uscc
+{
+namespace opt
+{
+
+bool MemReport::sEnabled = false;
+
+namespace
+{
+
+// Allocates straight from malloc, for the table of allocations
+template <typename T>
+struct MallocAllocator
+{
+	typedef T value_type;
+
+	MallocAllocator() { }
+	template <typename U>
+	MallocAllocator(const MallocAllocator<U>&) { }
+
+	T* allocate(size_t n)
+	{
+		void* ptr = std::malloc(n * sizeof(T));
+		if (ptr == nullptr)
+		{
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(ptr);
+	}
+
+	void deallocate(T* ptr, size_t)
+	{
+		std::free(ptr);
+	}
+
+	template <typename U>
+	bool operator==(const MallocAllocator<U>&) const
+	{
+		return true;
+	}
+
+	template <typename U>
+	bool operator!=(const MallocAllocator<U>&) const
+	{
+		return false;
+	}
+};
+
+struct Allocation
+{
+	size_t mSize;
+	MemTag mTag;
+};
+
+struct TagCounts
+{
+	TagCounts()
+	: mLiveBytes(0)
+	, mLiveAllocs(0)
+	, mAllocs(0)
+	, mPeakBytes(0)
+	{ }
+
+	size_t mLiveBytes;
+	size_t mLiveAllocs;
+	// Every allocation since start, freed or not
+	size_t mAllocs;
+	size_t mPeakBytes;
+};
+
+typedef std::unordered_map<void*, Allocation, std::hash<void*>, std::equal_to<void*>,
+	MallocAllocator<std::pair<void* const, Allocation>>> AllocationMap;
+
+struct Tracker
+{
+	std::mutex mMutex;
+	AllocationMap mAllocations;
+	TagCounts mCounts[static_cast<size_t>(MemTag::NumTags)];
+};
+
+// Made by start, and never destroyed, since static destructors
+// can still free things after it would have been
+Tracker* sTracker = nullptr;
+
+thread_local MemTag sCurrentTag = MemTag::Other;
+
+const char* TAG_NAMES[] = {
+	"other",
+	"ast",
+	"symbols",
+	"ssa",
+	"errors",
+	"llvm ir",
+	"codegen",
+};
+
+}
+
+void MemReport::start()
+{
+	if (sTracker == nullptr)
+	{
+		void* mem = std::malloc(sizeof(Tracker));
+		if (mem == nullptr)
+		{
+			return;
+		}
+		sTracker = new (mem) Tracker();
+	}
+	sEnabled = true;
+}
+
+void MemReport::recordAlloc(void* ptr, size_t size) noexcept
+{
+	MemTag tag = sCurrentTag;
+	std::lock_guard<std::mutex> lock(sTracker->mMutex);
+	try
+	{
+		Allocation alloc;
+		alloc.mSize = size;
+		alloc.mTag = tag;
+		sTracker->mAllocations[ptr] = alloc;
+	}
+	catch (std::bad_alloc&)
+	{
+		// Out of memory for the table, so this one isn't counted
+		return;
+	}
+
+	TagCounts& counts = sTracker->mCounts[static_cast<size_t>(tag)];
+	counts.mLiveBytes += size;
+	counts.mLiveAllocs++;
+	counts.mAllocs++;
+	if (counts.mLiveBytes > counts.mPeakBytes)
+	{
+		counts.mPeakBytes = counts.mLiveBytes;
+	}
+}
+
+void MemReport::recordFree(void* ptr) noexcept
+{
+	std::lock_guard<std::mutex> lock(sTracker->mMutex);
+	auto iter = sTracker->mAllocations.find(ptr);
+	if (iter == sTracker->mAllocations.end())
+	{
+		return;
+	}
+
+	TagCounts& counts = sTracker->mCounts[static_cast<size_t>(iter->second.mTag)];
+	counts.mLiveBytes -= iter->second.mSize;
+	counts.mLiveAllocs--;
+	sTracker->mAllocations.erase(iter);
+}
+
+void MemReport::write(const char* phase, std::ostream& out)
+{
+	if (!sEnabled)
+	{
+		return;
+	}
+
+	// Copied first, since writing allocates
+	const size_t numTags = static_cast<size_t>(MemTag::NumTags);
+	TagCounts counts[numTags];
+	{
+		std::lock_guard<std::mutex> lock(sTracker->mMutex);
+		for (size_t i = 0; i < numTags; i++)
+		{
+			counts[i] = sTracker->mCounts[i];
+		}
+	}
+
+	out << "Memory after " << phase << ":\n";
+	out << std::left << std::setw(10) << "subsystem" << std::right
+		<< std::setw(14) << "live bytes" << std::setw(13) << "live allocs"
+		<< std::setw(14) << "peak bytes" << std::setw(13) << "allocs" << "\n";
+	TagCounts total;
+	for (size_t i = 0; i < numTags; i++)
+	{
+		out << std::left << std::setw(10) << TAG_NAMES[i] << std::right
+			<< std::setw(14) << counts[i].mLiveBytes << std::setw(13) << counts[i].mLiveAllocs
+			<< std::setw(14) << counts[i].mPeakBytes << std::setw(13) << counts[i].mAllocs << "\n";
+		total.mLiveBytes += counts[i].mLiveBytes;
+		total.mLiveAllocs += counts[i].mLiveAllocs;
+		total.mAllocs += counts[i].mAllocs;
+	}
+	// Each subsystem peaks at a different time, so there's no total peak
+	out << std::left << std::setw(10) << "total" << std::right
+		<< std::setw(14) << total.mLiveBytes << std::setw(13) << total.mLiveAllocs
+		<< std::setw(14) << "" << std::setw(13) << total.mAllocs << "\n";
+	out.flush();
+}
+
+MemScope::MemScope(MemTag tag) noexcept
+: mPrev(sCurrentTag)
+{
+	sCurrentTag = tag;
+}
+
+MemScope::~MemScope()
+{
+	sCurrentTag = mPrev;
+}
+
+} // opt
+} // uscc
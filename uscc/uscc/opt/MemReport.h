@@ -0,0 +1,88 @@
+//
+//  MemReport.h
+//  uscc
+//
+//  Declares the memory accounting for --mem-report. While
+//  it's on, each allocation is charged to the subsystem the
+//  allocating thread is working for (see MemScope), and the
+//  bytes and allocations still live in each subsystem can be
+//  reported at the end of each phase of the compile.
+//
+//  Allocations are seen through hooks on the global operator
+//  new/delete, which only the uscc executable installs (see
+//  uscc/MemHooks.cpp), so programs that link the compiler as a
+//  library keep their own allocator and report nothing.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#pragma once
+#include <cstddef>
+#include <ostream>
+
+namespace uscc
+{
+namespace opt
+{
+
+// What an allocation is for
+enum class MemTag : unsigned char
+{
+	Other,
+	// AST nodes, and the parser's own state
+	AST,
+	// SymbolTable (scopes and identifiers) and StringTable
+	Symbols,
+	// SSABuilder's maps
+	SSA,
+	// The parser's error list
+	Errors,
+	// The LLVM module and the passes that work on it
+	IR,
+	// Code generation and register allocation
+	Codegen,
+	NumTags
+};
+
+class MemReport
+{
+public:
+	// Starts counting. Only allocations made after this are counted.
+	static void start();
+
+	static bool enabled() noexcept
+	{
+		return sEnabled;
+	}
+
+	// Called by the allocation hooks
+	static void recordAlloc(void* ptr, size_t size) noexcept;
+	static void recordFree(void* ptr) noexcept;
+
+	// Writes what's live in each subsystem after phase
+	static void write(const char* phase, std::ostream& out);
+
+private:
+	static bool sEnabled;
+};
+
+// Charges the current thread's allocations to tag, until it's destroyed
+class MemScope
+{
+public:
+	explicit MemScope(MemTag tag) noexcept;
+	~MemScope();
+
+private:
+	MemScope(const MemScope&) = delete;
+	MemScope& operator=(const MemScope&) = delete;
+
+	MemTag mPrev;
+};
+
+} // opt
+} // uscc
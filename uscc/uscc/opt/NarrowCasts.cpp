@@ -0,0 +1,226 @@
+//
+//  NarrowCasts.cpp
+//  uscc
+//
+//  Implements the cast narrowing pass. Chars are promoted to
+//  int for every expression, so char code is full of sext
+//  and trunc pairs. This pass:
+//     * Folds a trunc of an extend into the original value
+//       (or a single cast)
+//     * Does add/sub/mul in the narrow type, if the result
+//       is only truncated back to it
+//     * Compares extended values in the narrow type
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/ValueHandle.h>
+#include <llvm/Transforms/Utils/Local.h>
+#pragma clang diagnostic pop
+#include <vector>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+// How deep to look through arithmetic for values to narrow
+static const unsigned MAX_DEPTH = 8;
+
+// Returns true if the low bits of v (of width ty) can be computed in ty.
+// This works for add, sub and mul, since the low bits of the result
+// only depend on the low bits of the operands.
+static bool canNarrow(Value* v, Type* ty, unsigned depth)
+{
+	if (isa<ConstantInt>(v))
+	{
+		return true;
+	}
+	if (isa<SExtInst>(v) || isa<ZExtInst>(v))
+	{
+		return cast<CastInst>(v)->getSrcTy() == ty;
+	}
+	if (BinaryOperator* binOp = dyn_cast<BinaryOperator>(v))
+	{
+		unsigned opcode = binOp->getOpcode();
+		if ((opcode == Instruction::Add || opcode == Instruction::Sub ||
+			 opcode == Instruction::Mul) && binOp->hasOneUse() && depth < MAX_DEPTH)
+		{
+			return canNarrow(binOp->getOperand(0), ty, depth + 1) &&
+				canNarrow(binOp->getOperand(1), ty, depth + 1);
+		}
+	}
+	return false;
+}
+
+// Computes v in ty, which canNarrow must have said is possible
+static Value* narrow(Value* v, Type* ty, IRBuilder<>& build)
+{
+	if (ConstantInt* c = dyn_cast<ConstantInt>(v))
+	{
+		return ConstantExpr::getTrunc(c, ty);
+	}
+	if (CastInst* ext = dyn_cast<CastInst>(v))
+	{
+		return ext->getOperand(0);
+	}
+	BinaryOperator* binOp = cast<BinaryOperator>(v);
+	Value* lhs = narrow(binOp->getOperand(0), ty, build);
+	Value* rhs = narrow(binOp->getOperand(1), ty, build);
+	return build.CreateBinOp(binOp->getOpcode(), lhs, rhs, binOp->getName());
+}
+
+// Returns the trunc's value without the round trip through the wide type,
+// or null if it can't be simplified
+static Value* narrowTrunc(TruncInst* trunc)
+{
+	Type* ty = trunc->getDestTy();
+	Value* src = trunc->getOperand(0);
+	IRBuilder<> build(trunc);
+
+	// Truncating an extend needs at most one cast
+	if (isa<SExtInst>(src) || isa<ZExtInst>(src))
+	{
+		CastInst* ext = cast<CastInst>(src);
+		Value* orig = ext->getOperand(0);
+		unsigned origBits = orig->getType()->getIntegerBitWidth();
+		unsigned bits = ty->getIntegerBitWidth();
+		if (origBits == bits)
+		{
+			return orig;
+		}
+		else if (origBits > bits)
+		{
+			return build.CreateTrunc(orig, ty, trunc->getName());
+		}
+		return build.CreateCast(ext->getOpcode(), orig, ty, trunc->getName());
+	}
+
+	if (isa<BinaryOperator>(src) && canNarrow(src, ty, 0))
+	{
+		return narrow(src, ty, build);
+	}
+
+	return nullptr;
+}
+
+// Returns v in ty if v is just a sign extended value from ty,
+// or a constant that fits in ty
+static Value* narrowCompareOperand(Value* v, Type* ty)
+{
+	if (SExtInst* ext = dyn_cast<SExtInst>(v))
+	{
+		return ext->getSrcTy() == ty ? ext->getOperand(0) : nullptr;
+	}
+	if (ConstantInt* c = dyn_cast<ConstantInt>(v))
+	{
+		if (c->getValue().isSignedIntN(ty->getIntegerBitWidth()))
+		{
+			return ConstantExpr::getTrunc(c, ty);
+		}
+	}
+	return nullptr;
+}
+
+// Sign extension keeps the order of values (signed and unsigned),
+// so comparing two sign extended values can be done before extending
+static Value* narrowCompare(ICmpInst* cmp)
+{
+	SExtInst* ext = dyn_cast<SExtInst>(cmp->getOperand(0));
+	if (ext == nullptr)
+	{
+		ext = dyn_cast<SExtInst>(cmp->getOperand(1));
+	}
+	if (ext == nullptr)
+	{
+		return nullptr;
+	}
+
+	Type* ty = ext->getSrcTy();
+	Value* lhs = narrowCompareOperand(cmp->getOperand(0), ty);
+	Value* rhs = narrowCompareOperand(cmp->getOperand(1), ty);
+	if (lhs == nullptr || rhs == nullptr)
+	{
+		return nullptr;
+	}
+
+	IRBuilder<> build(cmp);
+	return build.CreateICmp(cmp->getPredicate(), lhs, rhs, cmp->getName());
+}
+
+bool NarrowCasts::runOnFunction(Function& F)
+{
+	// Narrowing one instruction can delete others, so use weak handles
+	std::vector<WeakVH> work;
+	for (auto& BB : F)
+	{
+		for (auto& I : BB)
+		{
+			if (isa<TruncInst>(&I) || isa<ICmpInst>(&I))
+			{
+				work.push_back(WeakVH(&I));
+			}
+		}
+	}
+
+	unsigned narrowed = 0;
+	for (auto& handle : work)
+	{
+		Value* v = handle;
+		Instruction* I = cast_or_null<Instruction>(v);
+		if (I == nullptr)
+		{
+			continue;
+		}
+		
+		Value* replacement = nullptr;
+		if (TruncInst* trunc = dyn_cast<TruncInst>(I))
+		{
+			replacement = narrowTrunc(trunc);
+		}
+		else
+		{
+			replacement = narrowCompare(cast<ICmpInst>(I));
+		}
+
+		if (replacement)
+		{
+			I->replaceAllUsesWith(replacement);
+			// This also removes the extends and wide math, unless
+			// something else is using them
+			RecursivelyDeleteTriviallyDeadInstructions(I);
+			narrowed++;
+		}
+	}
+
+	if (OptStatsConfig* stats = getAnalysisIfAvailable<OptStatsConfig>())
+	{
+		stats->count(F, "narrow", "instructions narrowed", narrowed);
+	}
+
+	return narrowed > 0;
+}
+
+void NarrowCasts::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// This pass does not alter the CFG
+	Info.setPreservesCFG();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::NarrowCasts::ID = 0;
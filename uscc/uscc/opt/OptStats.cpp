@@ -0,0 +1,164 @@
+//
+//  OptStats.cpp
+//  uscc
+//
+//  Implements collection and output of the statistics
+//  the opt passes report (see --stats)
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+#pragma clang diagnostic pop
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+void countStat(std::vector<OptStats>& stats, const std::string& function,
+			   const char* pass, const char* counter, unsigned count)
+{
+	// Passes report on the function they're running on, so
+	// it's usually the last one
+	OptStats* entry = nullptr;
+	if (!stats.empty() && stats.back().mFunction == function)
+	{
+		entry = &stats.back();
+	}
+	else
+	{
+		for (auto& s : stats)
+		{
+			if (s.mFunction == function)
+			{
+				entry = &s;
+				break;
+			}
+		}
+	}
+
+	if (entry == nullptr)
+	{
+		stats.push_back(OptStats());
+		entry = &stats.back();
+		entry->mFunction = function;
+	}
+	entry->mCounts[pass][counter] += count;
+}
+
+OptStatsConfig::OptStatsConfig(std::vector<OptStats>* stats)
+: ImmutablePass(ID)
+, mStats(stats)
+{
+
+}
+
+void OptStatsConfig::count(const Function& F, const char* pass, const char* counter,
+						   unsigned count)
+{
+	if (mStats)
+	{
+		countStat(*mStats, F.getName().str(), pass, counter, count);
+	}
+}
+
+static void writeJson(const std::vector<OptStats>& stats, raw_ostream& out)
+{
+	out << "{\n  \"functions\": [";
+	for (size_t i = 0; i < stats.size(); i++)
+	{
+		const OptStats& s = stats[i];
+		out << (i == 0 ? "\n" : ",\n");
+		out << "    { \"name\": \"" << s.mFunction << "\", \"passes\": {";
+		bool firstPass = true;
+		for (auto& pass : s.mCounts)
+		{
+			out << (firstPass ? " " : ", ") << "\"" << pass.first << "\": {";
+			bool firstCounter = true;
+			for (auto& counter : pass.second)
+			{
+				out << (firstCounter ? " " : ", ") << "\"" << counter.first << "\": "
+					<< counter.second;
+				firstCounter = false;
+			}
+			out << " }";
+			firstPass = false;
+		}
+		out << " } }";
+	}
+	out << "\n  ]\n}\n";
+}
+
+static void writeTable(const std::vector<OptStats>& stats, raw_ostream& out)
+{
+	const char* rowFormat = "%-24s %-12s %-28s %8u\n";
+	out << format("%-24s %-12s %-28s %8s\n", "function", "pass", "counter", "count");
+
+	std::map<std::string, std::map<std::string, unsigned>> totals;
+	for (auto& s : stats)
+	{
+		for (auto& pass : s.mCounts)
+		{
+			for (auto& counter : pass.second)
+			{
+				out << format(rowFormat, s.mFunction.c_str(), pass.first.c_str(),
+							  counter.first.c_str(), counter.second);
+				totals[pass.first][counter.first] += counter.second;
+			}
+		}
+	}
+
+	out << "\n";
+	for (auto& pass : totals)
+	{
+		for (auto& counter : pass.second)
+		{
+			out << format(rowFormat, "(total)", pass.first.c_str(),
+						  counter.first.c_str(), counter.second);
+		}
+	}
+}
+
+void writeOptStats(const std::vector<OptStats>& stats, raw_ostream& out, bool json)
+{
+	if (json)
+	{
+		writeJson(stats, out);
+	}
+	else
+	{
+		writeTable(stats, out);
+	}
+}
+
+bool saveOptStats(const char* fileName, const std::vector<OptStats>& stats)
+{
+	std::string statsErr;
+	raw_fd_ostream statsOut(fileName, statsErr, sys::fs::F_Text);
+	if (!statsErr.empty())
+	{
+		errs() << fileName << ": " << statsErr << "\n";
+		return false;
+	}
+	StringRef name(fileName);
+	writeOptStats(stats, statsOut, name.endswith(".json"));
+	return true;
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::OptStatsConfig::ID = 0;
@@ -15,8 +15,22 @@
 
 #include "Passes.h"
 #include <llvm/IR/Dominators.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/ADT/Triple.h>
 #include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetLibraryInfo.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Vectorize.h>
+#include <llvm/InitializePasses.h>
 #include <llvm/PassRegistry.h>
+#include <memory>
 
 using namespace llvm;
 
@@ -25,17 +39,139 @@ namespace uscc
 namespace opt
 {
 
-void registerOptPasses(legacy::PassManager& pm)
+void initializeOptPasses()
 {
 	PassRegistry& pr = *PassRegistry::getPassRegistry();
 	initializeLoopInfoPass(pr);
 	initializeDominatorTreeWrapperPassPass(pr);
-	pm.add(new ConstantOps());
-	pm.add(new ConstantBranch());
-	pm.add(new DeadBlocks());
-	pm.add(new LICM());
-	pm.add(new DominatorTreeWrapperPass());
-	pm.add(new LoopInfo());
+	// For the LLVM passes at -O2 and -O3
+	initializeCore(pr);
+	initializeAnalysis(pr);
+	initializeIPA(pr);
+	initializeScalarOpts(pr);
+	initializeInstCombine(pr);
+	initializeVectorization(pr);
+	initializeIPO(pr);
+	initializeTransformUtils(pr);
+	initializeTarget(pr);
+}
+
+// Lets the LLVM passes know about the target, if there is one
+static void addTargetInfo(legacy::PassManagerBase& pm, const OptOptions& options)
+{
+	if (!options.mTarget)
+	{
+		return;
+	}
+	
+	pm.add(new TargetLibraryInfo(Triple(options.mTarget->getTargetTriple())));
+	if (const DataLayout* DL = options.mTarget->getDataLayout())
+	{
+		pm.add(new DataLayoutPass(*DL));
+	}
+	options.mTarget->addAnalysisPasses(pm);
+}
+
+// The function simplification part of LLVM's -O2 pipeline (see
+// PassManagerBuilder). Only function and loop passes are used, so
+// each function can still be optimized on its own.
+static void addScalarPasses(legacy::PassManagerBase& pm)
+{
+	addTracedPass(pm, createSROAPass());
+	addTracedPass(pm, createEarlyCSEPass());
+	addTracedPass(pm, createJumpThreadingPass());
+	addTracedPass(pm, createCorrelatedValuePropagationPass());
+	addTracedPass(pm, createCFGSimplificationPass());
+	addTracedPass(pm, createInstructionCombiningPass());
+	addTracedPass(pm, createReassociatePass());
+	// These share one loop pass manager, so they're traced as one
+	addTracedGroup(pm, "loop passes", {
+		createLoopRotatePass(),
+		createLICMPass(),
+		createIndVarSimplifyPass(),
+		createLoopIdiomPass(),
+		createLoopDeletionPass(),
+	});
+	addTracedPass(pm, createGVNPass());
+	addTracedPass(pm, createSCCPPass());
+	addTracedPass(pm, createInstructionCombiningPass());
+	addTracedPass(pm, createDeadStoreEliminationPass());
+	addTracedPass(pm, createAggressiveDCEPass());
+	addTracedPass(pm, createCFGSimplificationPass());
+}
+
+void registerOptPasses(legacy::PassManagerBase& pm, const OptOptions& options)
+{
+	initializeOptPasses();
+	if (options.mLevel >= 2)
+	{
+		addTargetInfo(pm, options);
+	}
+	
+	addPipeline(pm, options);
+	
+	if (options.mLevel >= 2)
+	{
+		addScalarPasses(pm);
+	}
+	
+	// Loops are rotated by now, which the vectorizers need
+	if (options.mLevel >= 3)
+	{
+		addTracedPass(pm, createLoopVectorizePass());
+		addTracedPass(pm, createSLPVectorizerPass());
+		addTracedPass(pm, createInstructionCombiningPass());
+		addTracedPass(pm, createCFGSimplificationPass());
+	}
+}
+
+void registerInterprocPasses(legacy::PassManagerBase& pm, const OptOptions& options)
+{
+	if (options.mLevel < 3)
+	{
+		return;
+	}
+	
+	initializeOptPasses();
+	addTargetInfo(pm, options);
+	// Function passes added after the inliner run on each caller once
+	// its callees are inlined, to clean up after them
+	pm.add(createFunctionInliningPass());
+	pm.add(createEarlyCSEPass());
+	pm.add(createInstructionCombiningPass());
+	pm.add(createGVNPass());
+	pm.add(createCFGSimplificationPass());
+}
+
+std::string optimizeIsolated(const std::string& bitcode, const std::string& funcName,
+							 const OptOptions& options)
+{
+	LLVMContext ctx;
+	std::unique_ptr<MemoryBuffer> buffer(MemoryBuffer::getMemBuffer(bitcode, "", false));
+	ErrorOr<Module*> result = parseBitcodeFile(buffer.get(), ctx);
+	if (!result)
+	{
+		return std::string();
+	}
+	std::unique_ptr<Module> mod(result.get());
+	
+	Function* func = mod->getFunction(funcName);
+	if (!func)
+	{
+		return std::string();
+	}
+	
+	legacy::FunctionPassManager fpm(mod.get());
+	registerOptPasses(fpm, options);
+	fpm.doInitialization();
+	fpm.run(*func);
+	fpm.doFinalization();
+	
+	std::string optimized;
+	raw_string_ostream out(optimized);
+	WriteBitcodeToFile(mod.get(), out);
+	out.flush();
+	return optimized;
 }
 
 } // opt
@@ -4,13 +4,22 @@
 //
 //  Declares the opt passes supported by USCC
 //
-//  At the moment, there are four passes:
+//  At the moment, there are ten passes:
+//     * Tail recursion elimination
 //     * Constant op removal
 //     * Constant branch folding
 //     * Removal of dead blocks from CFG
+//     * Narrowing of char casts and arithmetic
+//     * Aggressive dead code elimination (ADCE)
 //     * Loop Invariant Code Motion (LICM)
+//     * Loop unrolling
+//     * CFG simplification
+//     * printf specialization
 //
-//  These passes will execute if uscc is ran with -O
+//  These passes will execute if uscc is ran with -O (or -O1).
+//  --passes picks which ones run, and in what order.
+//  -O2 follows them with LLVM's standard scalar passes, and -O3
+//  also adds loop and SLP vectorization, and inlining.
 //
 //---------------------------------------------------------
 //  Copyright (c) 2014, Sanjay Madhav
@@ -27,9 +36,19 @@
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Dominators.h>
 #pragma clang diagnostic pop
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm
+{
+	class raw_ostream;
+	class TargetMachine;
+}
 
 using llvm::FunctionPass;
 using llvm::LoopPass;
+using llvm::ImmutablePass;
 
 namespace uscc
 {
@@ -37,8 +56,101 @@ namespace uscc
 namespace opt
 {
 
+struct OptStats;
+
+// Settings for the opt passes
+struct OptOptions
+{
+	OptOptions()
+	: mLevel(1)
+	, mUnrollFactor(0)
+	, mTarget(nullptr)
+	, mStats(nullptr)
+	{ }
+	
+	// 1 only runs the uscc passes, 2 adds LLVM's scalar passes,
+	// and 3 adds vectorization (and inlining, see registerInterprocPasses)
+	unsigned mLevel;
+	
+	// How many copies of the body partially unrolled loops get.
+	// 0 or 1 means only loops with constant trip counts are unrolled.
+	unsigned mUnrollFactor;
+	
+	// The uscc passes to run (see checkPipeline). If empty, or not
+	// a valid pipeline, DEFAULT_PIPELINE is used.
+	std::string mPipeline;
+	
+	// Target the LLVM passes make cost decisions for (not owned).
+	// If null, they use generic costs, and the vectorizers do nothing.
+	llvm::TargetMachine* mTarget;
+	
+	// If non-null, the passes add what they did for each function here
+	std::vector<OptStats>* mStats;
+};
+
+// The uscc passes run by default, in order
+extern const char* DEFAULT_PIPELINE;
+
+// Checks that spec is a valid pass pipeline. A pipeline is a comma
+// separated list of pass names (tailrec, constops, constbr, deadblocks,
+// narrow, adce, licm, unroll, cfgsimplify and printf). A group in brackets, such
+// as [constops,constbr,deadblocks]*3, is repeated until none of its passes
+// change anything, up to 3 times (or 4 without a count).
+// If spec isn't valid, returns false and sets error.
+bool checkPipeline(const std::string& spec, std::string& error);
+
+// Returns a name for spec that can be used in a file name
+std::string pipelineTag(const std::string& spec);
+
+// Adds the uscc passes in options.mPipeline to pm
+void addPipeline(llvm::legacy::PassManagerBase& pm, const OptOptions& options);
+
+// Adds pass to pm. With --trace (see Trace.h), it's bracketed by passes
+// that record how long it takes on each function, under name (or its
+// pass name). Only for function and loop passes, and not for a loop pass
+// next to another one (see addTracedGroup).
+void addTracedPass(llvm::legacy::PassManagerBase& pm, llvm::Pass* pass,
+				   const char* name = nullptr);
+
+// Like addTracedPass, but passes are timed together, as one span. Adjacent
+// loop passes have to be added this way: anything between them makes the
+// pass manager run each over every loop separately, rather than all of them
+// on one loop at a time, which would change the code tracing is measuring.
+void addTracedGroup(llvm::legacy::PassManagerBase& pm, const char* name,
+					const std::vector<llvm::Pass*>& passes);
+
 // Helper function for registering the opt passes
-void registerOptPasses(llvm::legacy::PassManager& pm);
+void registerOptPasses(llvm::legacy::PassManagerBase& pm,
+					   const OptOptions& options = OptOptions());
+
+// Helper function for registering the passes that look at more than one
+// function (inlining, at -O3). Their results depend on other functions,
+// so they can't run on one function at a time like registerOptPasses'.
+// Adds nothing below -O3.
+void registerInterprocPasses(llvm::legacy::PassManagerBase& pm,
+							 const OptOptions& options = OptOptions());
+
+// Registers the analyses the opt passes depend on. registerOptPasses
+// does this too, but it should be done before starting threads.
+void initializeOptPasses();
+
+// Runs the opt passes over the function named funcName in bitcode
+// (from extractFunction), using a private LLVMContext so it can be
+// called from any thread. Returns the optimized bitcode, or an
+// empty string on failure.
+std::string optimizeIsolated(const std::string& bitcode, const std::string& funcName,
+							 const OptOptions& options = OptOptions());
+
+// Declares the Tail Recursion Elimination Pass
+struct TailRecursion : public FunctionPass
+{
+	static char ID;
+	TailRecursion() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+};
 
 // Declares the Constant Propagation Pass
 struct ConstantOps : public FunctionPass
@@ -72,6 +184,128 @@ struct DeadBlocks : public FunctionPass
 	
 	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
 };
+
+// Declares the Cast Narrowing Pass
+struct NarrowCasts : public FunctionPass
+{
+	static char ID;
+	NarrowCasts() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+};
+
+// Declares the Aggressive Dead Code Elimination Pass
+struct ADCE : public FunctionPass
+{
+	static char ID;
+	ADCE() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+};
+
+// Declares the CFG Simplification Pass
+struct CFGSimplify : public FunctionPass
+{
+	static char ID;
+	CFGSimplify() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+};
+	
+// Optimization statistics for a single function
+struct OptStats
+{
+	std::string mFunction;
+	// Counts of what was done, by pass and then by counter
+	// (for example, "constops" and "folded")
+	std::map<std::string, std::map<std::string, unsigned>> mCounts;
+};
+
+// Adds count to a counter for function in stats (a new entry is
+// added for the function, if it's not the last one in stats)
+void countStat(std::vector<OptStats>& stats, const std::string& function,
+			   const char* pass, const char* counter, unsigned count);
+
+// Collects OptStats. registerOptPasses adds one if OptOptions::mStats is
+// set, and passes report to it (if it's available) as they run.
+struct OptStatsConfig : public ImmutablePass
+{
+	static char ID;
+	OptStatsConfig(std::vector<OptStats>* stats = nullptr);
+	
+	void count(const llvm::Function& F, const char* pass, const char* counter,
+			   unsigned count);
+	
+	std::vector<OptStats>* mStats;
+};
+
+// Writes optimization statistics as JSON, or as a table followed
+// by the totals for each counter
+void writeOptStats(const std::vector<OptStats>& stats, llvm::raw_ostream& out,
+				   bool json);
+
+// Writes optimization statistics to fileName (as JSON if it ends
+// in .json). Returns false if the file can't be opened.
+bool saveOptStats(const char* fileName, const std::vector<OptStats>& stats);
+
+// Register allocation statistics for a single function
+struct RegAllocStats
+{
+	RegAllocStats()
+	: mVertices(0)
+	, mEdges(0)
+	, mMaxDegree(0)
+	, mSpills(0)
+	, mReloads(0)
+	, mSplits(0)
+	, mTimeMs(0.0)
+	{ }
+	
+	std::string mFunction;
+	// Interference graph size before simplification
+	unsigned mVertices;
+	unsigned mEdges;
+	unsigned mMaxDegree;
+	// Intervals handed to the spiller
+	unsigned mSpills;
+	// Loads from spill slots left in the function
+	unsigned mReloads;
+	// New virtual registers created while spilling
+	unsigned mSplits;
+	double mTimeMs;
+};
+
+// Settings for the USCC register allocator (RAUSCC).
+// Add one to the codegen PassManager; the allocator reads it
+// at the start of each function, so separate pass managers
+// can allocate with different settings.
+struct RegAllocConfig : public ImmutablePass
+{
+	static char ID;
+	RegAllocConfig(unsigned maxColors = 0,
+				   std::vector<RegAllocStats>* stats = nullptr);
+	
+	// Upper bound on the number of colors for every register class.
+	// 0 means no cap (K is the number of allocatable registers in the class)
+	unsigned mMaxColors;
+	
+	// If non-null, the allocator appends the stats for each function here
+	std::vector<RegAllocStats>* mStats;
+};
+
+// Makes RAUSCC the register allocator for code generation, in place
+// of the target's default. Not thread safe; call it once, up front.
+void useUSCCRegisterAllocator();
+
+// Writes register allocation statistics as JSON
+void writeRegAllocStats(const std::vector<RegAllocStats>& stats,
+						llvm::raw_ostream& out);
 	
 // Loop invariant code motion
 struct LICM : public LoopPass
@@ -101,6 +335,35 @@ struct LICM : public LoopPass
 	// Denotes whether or not loop has been modified
 	bool mChanged;
 };
+
+// Declares the Loop Unrolling Pass. Loops with a constant trip count
+// are unrolled fully; loops counting up (or down) by one to a limit
+// are unrolled factor times, with the original loop as the remainder.
+struct LoopUnroll : public FunctionPass
+{
+	static char ID;
+	LoopUnroll(unsigned factor = 0);
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+	
+	unsigned mFactor;
+};
+
+// Declares the printf Specialization Pass (see Printf.h). printf calls
+// with constant formats are replaced with calls that don't parse the
+// format: puts for text ending in a newline, putchar for one character
+// or a lone %c, and a helper that prints an int and a newline for "%d\n".
+struct PrintfSpecialize : public FunctionPass
+{
+	static char ID;
+	PrintfSpecialize() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+};
 	
 } // opt
 } // uscc
\ No newline at end of file
@@ -0,0 +1,330 @@
+//
+//  Pipeline.cpp
+//  uscc
+//
+//  Implements textual pass pipelines, such as
+//     tailrec,[constops,constbr,deadblocks]*4,licm
+//  Names are run in order. A group in brackets is run over
+//  each function again and again, until none of its passes
+//  change anything, or it has run *N times.
+//
+//  (it's here because it must be compiled with -fno-rtti)
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#pragma clang diagnostic pop
+#include <cctype>
+#include <memory>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+// tailrec runs first, so LICM sees the loops it makes, and adce cleans
+// up after the constant passes before LICM. unroll runs after LICM, so
+// invariant code is hoisted once instead of copied. cfgsimplify runs
+// after the loop passes, since merging blocks can remove loop preheaders.
+// printf doesn't care where it runs, as it only rewrites calls.
+const char* DEFAULT_PIPELINE =
+	"tailrec,constops,constbr,deadblocks,narrow,adce,licm,unroll,cfgsimplify,printf";
+
+// How many times a group runs if it doesn't say
+static const unsigned DEFAULT_GROUP_ITERATIONS = 4;
+
+// The passes a pipeline can name
+struct PassEntry
+{
+	const char* mName;
+	Pass* (*mCreate)(const OptOptions& options);
+};
+
+static const PassEntry PASSES[] = {
+	{ "tailrec", [](const OptOptions&) -> Pass* { return new TailRecursion(); } },
+	{ "constops", [](const OptOptions&) -> Pass* { return new ConstantOps(); } },
+	{ "constbr", [](const OptOptions&) -> Pass* { return new ConstantBranch(); } },
+	{ "deadblocks", [](const OptOptions&) -> Pass* { return new DeadBlocks(); } },
+	{ "narrow", [](const OptOptions&) -> Pass* { return new NarrowCasts(); } },
+	{ "adce", [](const OptOptions&) -> Pass* { return new ADCE(); } },
+	{ "licm", [](const OptOptions&) -> Pass* { return new LICM(); } },
+	{ "unroll", [](const OptOptions& options) -> Pass* {
+		return new LoopUnroll(options.mUnrollFactor);
+	} },
+	{ "cfgsimplify", [](const OptOptions&) -> Pass* { return new CFGSimplify(); } },
+	{ "printf", [](const OptOptions&) -> Pass* { return new PrintfSpecialize(); } },
+};
+
+// One pass, or a repeated group of steps
+struct PipelineStep
+{
+	PipelineStep()
+	: mPass(nullptr)
+	, mIterations(0)
+	{ }
+
+	// Null for a group
+	const PassEntry* mPass;
+	std::vector<PipelineStep> mGroup;
+	unsigned mIterations;
+};
+
+static const PassEntry* findPass(const std::string& name)
+{
+	for (auto& entry : PASSES)
+	{
+		if (name == entry.mName)
+		{
+			return &entry;
+		}
+	}
+	return nullptr;
+}
+
+// Parses a comma separated list of steps from spec, starting at pos,
+// and stopping at the end of spec or a ']'
+static bool parseSequence(const std::string& spec, size_t& pos,
+						  std::vector<PipelineStep>& steps, std::string& error)
+{
+	while (true)
+	{
+		PipelineStep step;
+		if (pos < spec.size() && spec[pos] == '[')
+		{
+			size_t start = pos++;
+			if (!parseSequence(spec, pos, step.mGroup, error))
+			{
+				return false;
+			}
+			if (pos >= spec.size() || spec[pos] != ']')
+			{
+				error = "missing ']' for the group at " + std::to_string(start);
+				return false;
+			}
+			pos++;
+
+			step.mIterations = DEFAULT_GROUP_ITERATIONS;
+			if (pos < spec.size() && spec[pos] == '*')
+			{
+				size_t digits = ++pos;
+				while (pos < spec.size() && isdigit(spec[pos]))
+				{
+					pos++;
+				}
+				if (digits == pos || pos - digits > 6)
+				{
+					error = "expected an iteration count after '*' at " +
+						std::to_string(digits - 1);
+					return false;
+				}
+				step.mIterations = static_cast<unsigned>(
+					std::stoul(spec.substr(digits, pos - digits)));
+				if (step.mIterations == 0)
+				{
+					error = "a group has to run at least once";
+					return false;
+				}
+			}
+		}
+		else
+		{
+			size_t start = pos;
+			while (pos < spec.size() && (isalnum(spec[pos]) || spec[pos] == '_'))
+			{
+				pos++;
+			}
+			std::string name = spec.substr(start, pos - start);
+			if (name.empty())
+			{
+				error = "expected a pass name at " + std::to_string(start);
+				return false;
+			}
+			step.mPass = findPass(name);
+			if (step.mPass == nullptr)
+			{
+				error = "unknown pass '" + name + "'";
+				return false;
+			}
+		}
+		steps.push_back(step);
+
+		if (pos < spec.size() && spec[pos] == ',')
+		{
+			pos++;
+		}
+		else
+		{
+			return true;
+		}
+	}
+}
+
+static bool parsePipeline(const std::string& spec, std::vector<PipelineStep>& steps,
+						  std::string& error)
+{
+	size_t pos = 0;
+	if (!parseSequence(spec, pos, steps, error))
+	{
+		return false;
+	}
+	if (pos != spec.size())
+	{
+		error = "unexpected '" + spec.substr(pos, 1) + "' at " + std::to_string(pos);
+		return false;
+	}
+	return true;
+}
+
+static void addSteps(legacy::PassManagerBase& pm, const std::vector<PipelineStep>& steps,
+					 const OptOptions& options);
+
+// Runs a group of steps over each function until none of them
+// change anything. The group gets its own pass manager, since the
+// legacy pass manager can only run passes in a line.
+struct RepeatGroup : public FunctionPass
+{
+	static char ID;
+	RepeatGroup(const PipelineStep& step, const OptOptions& options)
+	: FunctionPass(ID)
+	, mStep(step)
+	, mOptions(options)
+	{ }
+
+	virtual bool doInitialization(Module& M) override
+	{
+		mPasses.reset(new legacy::FunctionPassManager(&M));
+		// The group's passes can't see the outer pass manager's analyses
+		if (mOptions.mStats)
+		{
+			mPasses->add(new OptStatsConfig(mOptions.mStats));
+		}
+		addSteps(*mPasses, mStep.mGroup, mOptions);
+		return mPasses->doInitialization();
+	}
+
+	virtual bool runOnFunction(Function& F) override
+	{
+		bool changed = false;
+		for (unsigned i = 0; i < mStep.mIterations; i++)
+		{
+			if (!mPasses->run(F))
+			{
+				break;
+			}
+			changed = true;
+		}
+		return changed;
+	}
+
+	virtual bool doFinalization(Module& M) override
+	{
+		bool changed = mPasses->doFinalization();
+		mPasses.reset();
+		return changed;
+	}
+
+	virtual void getAnalysisUsage(AnalysisUsage& Info) const override
+	{
+		// The passes in the group could change anything
+	}
+
+	PipelineStep mStep;
+	OptOptions mOptions;
+	std::unique_ptr<legacy::FunctionPassManager> mPasses;
+};
+
+static void addSteps(legacy::PassManagerBase& pm, const std::vector<PipelineStep>& steps,
+					 const OptOptions& options)
+{
+	// A run of loop passes (such as licm,licm) is traced as one span,
+	// so they still share a loop pass manager (see addTracedGroup)
+	std::vector<Pass*> loopPasses;
+	std::string loopNames;
+	for (auto& step : steps)
+	{
+		Pass* pass = step.mPass ? step.mPass->mCreate(options) : new RepeatGroup(step, options);
+		if (pass->getPassKind() == PT_Loop)
+		{
+			loopNames += (loopNames.empty() ? "" : ",") + std::string(step.mPass->mName);
+			loopPasses.push_back(pass);
+			continue;
+		}
+		
+		if (!loopPasses.empty())
+		{
+			addTracedGroup(pm, loopNames.c_str(), loopPasses);
+			loopPasses.clear();
+			loopNames.clear();
+		}
+		addTracedPass(pm, pass, step.mPass ? step.mPass->mName : "repeat group");
+	}
+	if (!loopPasses.empty())
+	{
+		addTracedGroup(pm, loopNames.c_str(), loopPasses);
+	}
+}
+
+bool checkPipeline(const std::string& spec, std::string& error)
+{
+	std::vector<PipelineStep> steps;
+	return parsePipeline(spec, steps, error);
+}
+
+std::string pipelineTag(const std::string& spec)
+{
+	std::string tag;
+	for (char c : spec)
+	{
+		switch (c)
+		{
+			case ',':
+				tag += '.';
+				break;
+			case '[':
+				tag += '(';
+				break;
+			case ']':
+				tag += ')';
+				break;
+			case '*':
+				tag += '+';
+				break;
+			default:
+				tag += c;
+				break;
+		}
+	}
+	return tag;
+}
+
+void addPipeline(legacy::PassManagerBase& pm, const OptOptions& options)
+{
+	std::vector<PipelineStep> steps;
+	std::string error;
+	if (options.mPipeline.empty() || !parsePipeline(options.mPipeline, steps, error))
+	{
+		steps.clear();
+		parsePipeline(DEFAULT_PIPELINE, steps, error);
+	}
+	if (options.mStats)
+	{
+		pm.add(new OptStatsConfig(options.mStats));
+	}
+	addSteps(pm, steps, options);
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::RepeatGroup::ID = 0;
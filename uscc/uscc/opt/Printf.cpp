@@ -0,0 +1,548 @@
+//
+//  Printf.cpp
+//  uscc
+//
+//  Implements the lowering of printf calls with constant
+//  format strings, and the printf Specialization Pass.
+//
+//  With --buffered-output, each piece of the format becomes a
+//  call to one of the runtime's print routines:
+//     literal text   __uscc_print_lit(text, length)
+//                    (or __uscc_print_char, for one character)
+//     %d             __uscc_print_int(value)
+//     %c             __uscc_print_char(value)
+//     %s             __uscc_print_str(str)
+//
+//  Otherwise, with -O, the printf pass rewrites the calls
+//  that have a direct equivalent in the C library:
+//     "text\n"       puts("text")
+//     "c", "%c"      putchar(c)
+//     "%d\n"         __uscc_print_int_line(value), which
+//                    definePrintHelpers adds to the module
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Printf.h"
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Analysis/ValueTracking.h>
+#pragma clang diagnostic pop
+#include <unordered_map>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+static void addLiteral(std::vector<FormatPiece>& pieces, size_t offset, size_t length)
+{
+	if (length > 0)
+	{
+		FormatPiece piece;
+		piece.mKind = FormatPiece::Literal;
+		piece.mOffset = offset;
+		piece.mLength = length;
+		pieces.push_back(piece);
+	}
+}
+
+bool parseFormat(const std::string& format, std::vector<FormatPiece>& pieces)
+{
+	pieces.clear();
+	size_t start = 0;
+	size_t i = 0;
+	while (i < format.size())
+	{
+		if (format[i] != '%')
+		{
+			i++;
+			continue;
+		}
+
+		addLiteral(pieces, start, i - start);
+		if (i + 1 >= format.size())
+		{
+			return false;
+		}
+
+		FormatPiece piece;
+		piece.mOffset = 0;
+		piece.mLength = 0;
+		switch (format[i + 1])
+		{
+			case 'd':
+			case 'i':
+				piece.mKind = FormatPiece::Int;
+				break;
+			case 'c':
+				piece.mKind = FormatPiece::Char;
+				break;
+			case 's':
+				piece.mKind = FormatPiece::String;
+				break;
+			case '%':
+				// The second % is the text
+				piece.mKind = FormatPiece::Literal;
+				piece.mOffset = i + 1;
+				piece.mLength = 1;
+				break;
+			default:
+				return false;
+		}
+		pieces.push_back(piece);
+
+		i += 2;
+		start = i;
+	}
+	addLiteral(pieces, start, i - start);
+	return true;
+}
+
+// Returns true if the arguments of call (a printf) match pieces
+static bool argsMatch(CallInst* call, const std::vector<FormatPiece>& pieces)
+{
+	unsigned arg = 1;
+	for (auto& piece : pieces)
+	{
+		if (piece.mKind == FormatPiece::Literal)
+		{
+			continue;
+		}
+		if (arg >= call->getNumArgOperands())
+		{
+			return false;
+		}
+
+		Type* type = call->getArgOperand(arg++)->getType();
+		bool isString = piece.mKind == FormatPiece::String;
+		if (isString ? !type->isPointerTy() : !type->isIntegerTy())
+		{
+			return false;
+		}
+	}
+	return arg == call->getNumArgOperands();
+}
+
+namespace
+{
+
+// The runtime's print routines
+struct PrintRoutines
+{
+	Constant* mInt;
+	Constant* mChar;
+	Constant* mStr;
+	Constant* mLit;
+	Constant* mFlush;
+};
+
+}
+
+// Replaces call with the print routines. Returns false, and leaves it
+// alone, if it can't be.
+static bool lowerCall(CallInst* call, const PrintRoutines& print)
+{
+	StringRef format;
+	std::vector<FormatPiece> pieces;
+	if (!call->use_empty() || call->getNumArgOperands() == 0 ||
+		!getConstantStringInfo(call->getArgOperand(0), format) ||
+		!parseFormat(format.str(), pieces) || !argsMatch(call, pieces))
+	{
+		return false;
+	}
+
+	IRBuilder<> build(call);
+	Type* int32Ty = build.getInt32Ty();
+	Value* formatPtr = call->getArgOperand(0);
+	unsigned arg = 1;
+	for (auto& piece : pieces)
+	{
+		switch (piece.mKind)
+		{
+			case FormatPiece::Literal:
+				if (piece.mLength == 1)
+				{
+					unsigned char c = static_cast<unsigned char>(format[piece.mOffset]);
+					build.CreateCall(print.mChar, build.getInt32(c));
+				}
+				else
+				{
+					// The text is already in the format string
+					Value* text = build.CreateConstInBoundsGEP1_32(formatPtr,
+						static_cast<unsigned>(piece.mOffset));
+					build.CreateCall2(print.mLit, text,
+									  build.getInt32(static_cast<uint32_t>(piece.mLength)));
+				}
+				break;
+			case FormatPiece::Int:
+				build.CreateCall(print.mInt,
+								 build.CreateSExtOrTrunc(call->getArgOperand(arg++), int32Ty));
+				break;
+			case FormatPiece::Char:
+				build.CreateCall(print.mChar,
+								 build.CreateSExtOrTrunc(call->getArgOperand(arg++), int32Ty));
+				break;
+			case FormatPiece::String:
+				build.CreateCall(print.mStr,
+								 build.CreatePointerCast(call->getArgOperand(arg++),
+														 build.getInt8PtrTy()));
+				break;
+		}
+	}
+
+	call->eraseFromParent();
+	return true;
+}
+
+void lowerPrintfToRuntime(Module& module)
+{
+	Function* printf = module.getFunction("printf");
+	if (printf == nullptr)
+	{
+		return;
+	}
+
+	LLVMContext& ctx = module.getContext();
+	Type* voidTy = Type::getVoidTy(ctx);
+	Type* int32Ty = Type::getInt32Ty(ctx);
+	Type* int8PtrTy = Type::getInt8PtrTy(ctx);
+	PrintRoutines print;
+	print.mInt = module.getOrInsertFunction("__uscc_print_int", voidTy, int32Ty, nullptr);
+	print.mChar = module.getOrInsertFunction("__uscc_print_char", voidTy, int32Ty, nullptr);
+	print.mStr = module.getOrInsertFunction("__uscc_print_str", voidTy, int8PtrTy, nullptr);
+	print.mLit = module.getOrInsertFunction("__uscc_print_lit", voidTy, int8PtrTy, int32Ty,
+											nullptr);
+	print.mFlush = module.getOrInsertFunction("__uscc_flush", voidTy, nullptr);
+
+	std::vector<CallInst*> calls;
+	for (User* user : printf->users())
+	{
+		CallInst* call = dyn_cast<CallInst>(user);
+		if (call && call->getCalledFunction() == printf)
+		{
+			calls.push_back(call);
+		}
+	}
+
+	for (CallInst* call : calls)
+	{
+		if (!lowerCall(call, print))
+		{
+			// printf writes to stdout, after what's in the buffer
+			CallInst::Create(print.mFlush, "", call);
+		}
+	}
+}
+
+static const char* INT_LINE_NAME = "__uscc_print_int_line";
+
+// Returns the declaration of the C library (or helper) function name, with
+// the given type, or null if name is already something else
+static Constant* getLibFunction(Module& module, const char* name, FunctionType* type)
+{
+	Function* func = module.getFunction(name);
+	if (func && (func->getFunctionType() != type ||
+				 (!func->isDeclaration() && name != INT_LINE_NAME)))
+	{
+		return nullptr;
+	}
+	return module.getOrInsertFunction(name, type);
+}
+
+// Returns the text printed by pieces, which must all be literals
+static std::string literalText(StringRef format, const std::vector<FormatPiece>& pieces)
+{
+	std::string text;
+	for (auto& piece : pieces)
+	{
+		text += format.substr(piece.mOffset, piece.mLength).str();
+	}
+	return text;
+}
+
+namespace
+{
+
+// The module's private string constants, by their contents (which
+// LLVM uniques, so equal strings have the same initializer)
+typedef std::unordered_map<Constant*, GlobalVariable*> StringGlobals;
+
+}
+
+// Returns the private string constants in module
+static StringGlobals findStrings(Module& module)
+{
+	StringGlobals strings;
+	for (auto gv = module.global_begin(); gv != module.global_end(); ++gv)
+	{
+		if (gv->isConstant() && gv->hasPrivateLinkage() && gv->hasInitializer())
+		{
+			strings[gv->getInitializer()] = gv;
+		}
+	}
+	return strings;
+}
+
+// Returns a pointer to a string constant holding text. It's only
+// made if the module doesn't have one yet (nothing else merges them).
+static Value* getString(Module& module, IRBuilder<>& build, StringGlobals& strings,
+						const std::string& text)
+{
+	Constant* init = ConstantDataArray::getString(module.getContext(), text);
+	GlobalVariable*& global = strings[init];
+	if (global == nullptr)
+	{
+		global = new GlobalVariable(module, init->getType(), true,
+									GlobalValue::PrivateLinkage, init, ".str");
+		global->setUnnamedAddr(true);
+	}
+	return build.CreateConstInBoundsGEP2_32(global, 0, 0);
+}
+
+namespace
+{
+
+// What PrintfSpecialize made of the calls it rewrote
+struct SpecializeCounts
+{
+	SpecializeCounts()
+	: mPuts(0)
+	, mPutchar(0)
+	, mIntLine(0)
+	{ }
+
+	unsigned mPuts;
+	unsigned mPutchar;
+	unsigned mIntLine;
+};
+
+}
+
+// Rewrites call (a printf), if there's a cheaper equivalent
+static bool specializeCall(CallInst* call, StringGlobals& strings, SpecializeCounts& counts)
+{
+	StringRef format;
+	std::vector<FormatPiece> pieces;
+	if (!call->use_empty() || call->getNumArgOperands() == 0 ||
+		!getConstantStringInfo(call->getArgOperand(0), format) ||
+		!parseFormat(format.str(), pieces) || !argsMatch(call, pieces))
+	{
+		return false;
+	}
+
+	Module& module = *call->getParent()->getParent()->getParent();
+	IRBuilder<> build(call);
+	Type* int32Ty = build.getInt32Ty();
+	FunctionType* putcharType = FunctionType::get(int32Ty, int32Ty, false);
+
+	bool allLiteral = true;
+	for (auto& piece : pieces)
+	{
+		allLiteral = allLiteral && piece.mKind == FormatPiece::Literal;
+	}
+
+	if (allLiteral)
+	{
+		std::string text = literalText(format, pieces);
+		if (text.empty())
+		{
+			call->eraseFromParent();
+			return true;
+		}
+
+		if (text.size() == 1)
+		{
+			Constant* putchar = getLibFunction(module, "putchar", putcharType);
+			if (!putchar)
+			{
+				return false;
+			}
+			build.CreateCall(putchar, build.getInt32(static_cast<unsigned char>(text[0])));
+			counts.mPutchar++;
+		}
+		else if (text.back() == '\n')
+		{
+			// puts adds the newline
+			FunctionType* putsType = FunctionType::get(int32Ty, build.getInt8PtrTy(), false);
+			Constant* puts = getLibFunction(module, "puts", putsType);
+			if (!puts)
+			{
+				return false;
+			}
+			text.pop_back();
+			build.CreateCall(puts, getString(module, build, strings, text));
+			counts.mPuts++;
+		}
+		else
+		{
+			// Writing this without printf needs fwrite(stdout), and
+			// stdout isn't named the same way on every platform
+			return false;
+		}
+	}
+	else if (pieces.size() == 1 && pieces[0].mKind == FormatPiece::Char)
+	{
+		Constant* putchar = getLibFunction(module, "putchar", putcharType);
+		if (!putchar)
+		{
+			return false;
+		}
+		build.CreateCall(putchar, build.CreateSExtOrTrunc(call->getArgOperand(1), int32Ty));
+		counts.mPutchar++;
+	}
+	else if (pieces.size() == 2 && pieces[0].mKind == FormatPiece::Int &&
+			 pieces[1].mKind == FormatPiece::Literal && pieces[1].mLength == 1 &&
+			 format[pieces[1].mOffset] == '\n')
+	{
+		FunctionType* intLineType = FunctionType::get(build.getVoidTy(), int32Ty, false);
+		Constant* intLine = getLibFunction(module, INT_LINE_NAME, intLineType);
+		if (!intLine)
+		{
+			return false;
+		}
+		build.CreateCall(intLine, build.CreateSExtOrTrunc(call->getArgOperand(1), int32Ty));
+		counts.mIntLine++;
+	}
+	else
+	{
+		return false;
+	}
+
+	call->eraseFromParent();
+	return true;
+}
+
+bool PrintfSpecialize::runOnFunction(Function& F)
+{
+	Function* printf = F.getParent()->getFunction("printf");
+	if (printf == nullptr)
+	{
+		return false;
+	}
+
+	std::vector<CallInst*> calls;
+	for (auto& bb : F)
+	{
+		for (auto& i : bb)
+		{
+			CallInst* call = dyn_cast<CallInst>(&i);
+			if (call && call->getCalledFunction() == printf)
+			{
+				calls.push_back(call);
+			}
+		}
+	}
+
+	StringGlobals strings;
+	if (!calls.empty())
+	{
+		strings = findStrings(*F.getParent());
+	}
+
+	SpecializeCounts counts;
+	bool changed = false;
+	for (CallInst* call : calls)
+	{
+		changed |= specializeCall(call, strings, counts);
+	}
+
+	if (OptStatsConfig* stats = getAnalysisIfAvailable<OptStatsConfig>())
+	{
+		stats->count(F, "printf", "calls to puts", counts.mPuts);
+		stats->count(F, "printf", "calls to putchar", counts.mPutchar);
+		stats->count(F, "printf", "calls to print int", counts.mIntLine);
+	}
+
+	return changed;
+}
+
+void PrintfSpecialize::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// This pass does not alter the CFG
+	Info.setPreservesCFG();
+}
+
+void definePrintHelpers(Module& module)
+{
+	Function* intLine = module.getFunction(INT_LINE_NAME);
+	if (intLine == nullptr || !intLine->isDeclaration())
+	{
+		return;
+	}
+
+	// void __uscc_print_int_line(int value)
+	// {
+	//     char buf[12];
+	//     unsigned n = value < 0 ? -value : value;
+	//     int pos = 11;
+	//     buf[11] = 0;
+	//     do { buf[--pos] = '0' + n % 10; n /= 10; } while (n != 0);
+	//     buf[pos - 1] = '-';
+	//     puts(value < 0 ? &buf[pos - 1] : &buf[pos]);
+	// }
+	LLVMContext& ctx = module.getContext();
+	Type* int32Ty = Type::getInt32Ty(ctx);
+	Type* int8Ty = Type::getInt8Ty(ctx);
+	Constant* puts = module.getOrInsertFunction("puts", int32Ty, Type::getInt8PtrTy(ctx),
+												nullptr);
+
+	intLine->setLinkage(GlobalValue::InternalLinkage);
+	BasicBlock* entry = BasicBlock::Create(ctx, "entry", intLine);
+	BasicBlock* loop = BasicBlock::Create(ctx, "digits", intLine);
+	BasicBlock* done = BasicBlock::Create(ctx, "done", intLine);
+	Value* value = intLine->arg_begin();
+	value->setName("value");
+
+	IRBuilder<> build(entry);
+	Value* zero = build.getInt32(0);
+	Value* buf = build.CreateAlloca(ArrayType::get(int8Ty, 12), nullptr, "buf");
+	Value* isNeg = build.CreateICmpSLT(value, zero, "neg");
+	Value* magnitude = build.CreateSelect(isNeg, build.CreateSub(zero, value), value);
+	build.CreateStore(build.getInt8(0), build.CreateConstInBoundsGEP2_32(buf, 0, 11));
+	build.CreateBr(loop);
+
+	build.SetInsertPoint(loop);
+	PHINode* n = build.CreatePHI(int32Ty, 2, "n");
+	PHINode* pos = build.CreatePHI(int32Ty, 2, "pos");
+	Value* nextPos = build.CreateSub(pos, build.getInt32(1));
+	Value* digit = build.CreateAdd(build.CreateTrunc(build.CreateURem(n, build.getInt32(10)),
+													 int8Ty), build.getInt8('0'));
+	Value* idx[] = { zero, nextPos };
+	build.CreateStore(digit, build.CreateInBoundsGEP(buf, idx));
+	Value* nextN = build.CreateUDiv(n, build.getInt32(10));
+	build.CreateCondBr(build.CreateICmpNE(nextN, zero), loop, done);
+	n->addIncoming(magnitude, entry);
+	n->addIncoming(nextN, loop);
+	pos->addIncoming(build.getInt32(11), entry);
+	pos->addIncoming(nextPos, loop);
+
+	// There are at most 10 digits, so there's always room for the sign
+	build.SetInsertPoint(done);
+	Value* signPos = build.CreateSub(nextPos, build.getInt32(1));
+	Value* signIdx[] = { zero, signPos };
+	Value* sign = build.CreateInBoundsGEP(buf, signIdx);
+	build.CreateStore(build.getInt8('-'), sign);
+	Value* digitsIdx[] = { zero, nextPos };
+	Value* start = build.CreateSelect(isNeg, sign, build.CreateInBoundsGEP(buf, digitsIdx));
+	build.CreateCall(puts, start);
+	build.CreateRetVoid();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::PrintfSpecialize::ID = 0;
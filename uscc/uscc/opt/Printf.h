@@ -0,0 +1,65 @@
+//
+//  Printf.h
+//  uscc
+//
+//  Declares the lowering of printf calls, whose format
+//  strings are almost always constants in USC, to cheaper
+//  calls that don't parse the format at run time.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#pragma once
+#include <string>
+#include <vector>
+
+namespace llvm
+{
+	class Module;
+}
+
+namespace uscc
+{
+namespace opt
+{
+
+// A piece of a printf format string
+struct FormatPiece
+{
+	enum Kind
+	{
+		Literal,
+		Int,
+		Char,
+		String
+	};
+
+	Kind mKind;
+	// For Literal, where its text is in the format string
+	size_t mOffset;
+	size_t mLength;
+};
+
+// Splits a printf format string into literal text and %d, %c and %s
+// conversions (%% is literal text). Returns false if it has any other
+// conversion, or flags, a width or a precision.
+bool parseFormat(const std::string& format, std::vector<FormatPiece>& pieces);
+
+// Replaces the printf calls in module that have a format parseFormat
+// understands, and whose results aren't used, with calls to the uscc
+// runtime's buffered print routines. The buffer is flushed before the
+// other printf calls, so the output stays in order. The runtime has to
+// be linked in (see Emitter::linkRuntime).
+void lowerPrintfToRuntime(llvm::Module& module);
+
+// PrintfSpecialize only declares the helper it calls for "%d\n", since it
+// may be running on a copy of one function (see optimizeIsolated). This
+// defines the helper in module, if it's used. Call it after optimizing.
+void definePrintHelpers(llvm::Module& module);
+
+} // opt
+} // uscc
@@ -0,0 +1,340 @@
+//
+//  Profile.cpp
+//  uscc
+//
+//  Implements profile instrumentation, and reading profiles
+//  back in as branch weights.
+//
+//  Each function gets an array of 64-bit counters: one per
+//  block, in order, followed by two for each conditional branch
+//  (how many times it went to successor 0, then successor 1).
+//  The profile file is text:
+//     uscc-profile 1
+//     <function> <blocks> <counters>
+//     <count>
+//     ...
+//
+//  The weights are picked up by everything that uses branch
+//  probabilities: block placement and the spill weights in
+//  the register allocator (through MachineBlockFrequencyInfo),
+//  the LLVM passes at -O2 and up, and LoopUnroll.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Profile.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+#pragma clang diagnostic pop
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+static const char* PROFILE_MAGIC = "uscc-profile";
+static const unsigned PROFILE_VERSION = 1;
+static const char* COUNTERS_PREFIX = "__uscc_prof.";
+static const char* DUMP_NAME = "__uscc_prof_dump";
+// Functions called at least this many times get inlinehint
+static const uint64_t HOT_CALL_COUNT = 1000;
+
+// Returns how many counters F needs, and sets blocks to
+// the number of blocks in F
+static unsigned countCounters(const Function& F, unsigned& blocks)
+{
+	blocks = 0;
+	unsigned counters = 0;
+	for (auto& bb : F)
+	{
+		blocks++;
+		counters++;
+		const BranchInst* br = dyn_cast_or_null<BranchInst>(bb.getTerminator());
+		if (br && br->isConditional())
+		{
+			counters += 2;
+		}
+	}
+	return counters;
+}
+
+// Adds one to counters[index]
+static void increment(IRBuilder<>& builder, GlobalVariable* counters, Value* index)
+{
+	Value* indices[] = { builder.getInt64(0), index };
+	Value* counter = builder.CreateInBoundsGEP(counters, indices);
+	Value* count = builder.CreateLoad(counter);
+	builder.CreateStore(builder.CreateAdd(count, builder.getInt64(1)), counter);
+}
+
+static void instrumentFunction(Function& F, GlobalVariable* counters, unsigned blocks)
+{
+	std::vector<BasicBlock*> bbs;
+	for (auto& bb : F)
+	{
+		bbs.push_back(&bb);
+	}
+
+	unsigned edge = blocks;
+	for (unsigned i = 0; i < bbs.size(); i++)
+	{
+		BasicBlock* bb = bbs[i];
+		IRBuilder<> builder(bb, bb->getFirstInsertionPt());
+		increment(builder, counters, builder.getInt64(i));
+
+		// Rather than splitting the edges, pick the counter with the condition
+		BranchInst* br = dyn_cast_or_null<BranchInst>(bb->getTerminator());
+		if (br && br->isConditional())
+		{
+			builder.SetInsertPoint(br);
+			Value* index = builder.CreateSelect(br->getCondition(),
+												builder.getInt64(edge),
+												builder.getInt64(edge + 1));
+			increment(builder, counters, index);
+			edge += 2;
+		}
+	}
+}
+
+// A function's counters, for the dump function
+struct Instrumented
+{
+	std::string mName;
+	GlobalVariable* mCounters;
+	unsigned mBlocks;
+	unsigned mNumCounters;
+};
+
+// Adds a function that writes all the counters to fileName, and
+// makes it a destructor so it runs when the program exits
+static void addDumpFunction(Module& module, const std::vector<Instrumented>& funcs,
+							const std::string& fileName)
+{
+	LLVMContext& ctx = module.getContext();
+	Type* int8Ptr = Type::getInt8PtrTy(ctx);
+	Type* int32 = Type::getInt32Ty(ctx);
+
+	// FILE* is treated as an i8*
+	Type* fileArgs[] = { int8Ptr, int8Ptr };
+	Constant* fopenFunc = module.getOrInsertFunction("fopen",
+		FunctionType::get(int8Ptr, fileArgs, false));
+	Constant* fprintfFunc = module.getOrInsertFunction("fprintf",
+		FunctionType::get(int32, fileArgs, true));
+	Constant* fcloseFunc = module.getOrInsertFunction("fclose",
+		FunctionType::get(int32, int8Ptr, false));
+
+	Function* dump = Function::Create(FunctionType::get(Type::getVoidTy(ctx), false),
+									  GlobalValue::InternalLinkage, DUMP_NAME, &module);
+	BasicBlock* entry = BasicBlock::Create(ctx, "entry", dump);
+	BasicBlock* write = BasicBlock::Create(ctx, "write", dump);
+	BasicBlock* done = BasicBlock::Create(ctx, "done", dump);
+
+	IRBuilder<> builder(entry);
+	Value* file = builder.CreateCall2(fopenFunc, builder.CreateGlobalStringPtr(fileName),
+									  builder.CreateGlobalStringPtr("w"));
+	builder.CreateCondBr(builder.CreateIsNull(file), done, write);
+
+	builder.SetInsertPoint(write);
+	std::string header = std::string(PROFILE_MAGIC) + " " +
+		std::to_string(PROFILE_VERSION) + "\n";
+	builder.CreateCall2(fprintfFunc, file, builder.CreateGlobalStringPtr(header));
+	Value* funcFormat = builder.CreateGlobalStringPtr("%s %u %u\n");
+	Value* countFormat = builder.CreateGlobalStringPtr("%llu\n");
+
+	for (auto& func : funcs)
+	{
+		Value* args[] = {
+			file, funcFormat, builder.CreateGlobalStringPtr(func.mName),
+			builder.getInt32(func.mBlocks), builder.getInt32(func.mNumCounters)
+		};
+		builder.CreateCall(fprintfFunc, args);
+
+		// Every function has at least one counter, so the loop
+		// can test at the bottom
+		BasicBlock* before = builder.GetInsertBlock();
+		BasicBlock* loop = BasicBlock::Create(ctx, "loop", dump, done);
+		BasicBlock* after = BasicBlock::Create(ctx, "after", dump, done);
+		builder.CreateBr(loop);
+
+		builder.SetInsertPoint(loop);
+		PHINode* index = builder.CreatePHI(builder.getInt64Ty(), 2);
+		index->addIncoming(builder.getInt64(0), before);
+		Value* indices[] = { builder.getInt64(0), index };
+		Value* count = builder.CreateLoad(builder.CreateInBoundsGEP(func.mCounters, indices));
+		builder.CreateCall3(fprintfFunc, file, countFormat, count);
+		Value* next = builder.CreateAdd(index, builder.getInt64(1));
+		index->addIncoming(next, loop);
+		builder.CreateCondBr(builder.CreateICmpULT(next, builder.getInt64(func.mNumCounters)),
+							 loop, after);
+
+		builder.SetInsertPoint(after);
+	}
+
+	builder.CreateCall(fcloseFunc, file);
+	builder.CreateBr(done);
+
+	builder.SetInsertPoint(done);
+	builder.CreateRetVoid();
+
+	appendToGlobalDtors(module, dump, 65535);
+}
+
+void instrumentProfile(Module& module, const std::string& fileName)
+{
+	Type* int64 = Type::getInt64Ty(module.getContext());
+
+	std::vector<Instrumented> funcs;
+	for (auto& F : module)
+	{
+		if (F.isDeclaration())
+		{
+			continue;
+		}
+
+		Instrumented func;
+		func.mName = F.getName().str();
+		func.mNumCounters = countCounters(F, func.mBlocks);
+		ArrayType* type = ArrayType::get(int64, func.mNumCounters);
+		func.mCounters = new GlobalVariable(module, type, false, GlobalValue::InternalLinkage,
+											ConstantAggregateZero::get(type),
+											COUNTERS_PREFIX + func.mName);
+		instrumentFunction(F, func.mCounters, func.mBlocks);
+		funcs.push_back(func);
+	}
+
+	addDumpFunction(module, funcs, fileName);
+}
+
+// Branch weights are 32-bit, so large counts are scaled down. Each count
+// is bumped by one so an edge that was never taken still has a weight.
+static MDNode* createWeights(LLVMContext& ctx, uint64_t taken, uint64_t notTaken)
+{
+	const uint64_t maxWeight = std::numeric_limits<uint32_t>::max() - 1;
+	uint64_t scale = std::max(taken, notTaken) / maxWeight + 1;
+	return MDBuilder(ctx).createBranchWeights(static_cast<uint32_t>(taken / scale + 1),
+											  static_cast<uint32_t>(notTaken / scale + 1));
+}
+
+// The counts read from the profile for one function
+struct FunctionProfile
+{
+	unsigned mBlocks;
+	std::vector<uint64_t> mCounts;
+};
+
+static void annotateFunction(Function& F, const FunctionProfile& profile)
+{
+	LLVMContext& ctx = F.getContext();
+	unsigned edge = profile.mBlocks;
+	for (auto& bb : F)
+	{
+		BranchInst* br = dyn_cast_or_null<BranchInst>(bb.getTerminator());
+		if (br && br->isConditional())
+		{
+			br->setMetadata(LLVMContext::MD_prof,
+							createWeights(ctx, profile.mCounts[edge], profile.mCounts[edge + 1]));
+			edge += 2;
+		}
+	}
+
+	// The entry block's count is the number of calls
+	uint64_t calls = profile.mCounts[0];
+	if (calls == 0 && F.getName() != "main")
+	{
+		F.addFnAttr(Attribute::Cold);
+	}
+	else if (calls >= HOT_CALL_COUNT)
+	{
+		F.addFnAttr(Attribute::InlineHint);
+	}
+}
+
+bool useProfile(Module& module, const std::string& fileName, std::string& error)
+{
+	std::ifstream file(fileName);
+	std::string magic;
+	unsigned version = 0;
+	if (!(file >> magic >> version) || magic != PROFILE_MAGIC)
+	{
+		error = "not a uscc profile";
+		return false;
+	}
+	if (version != PROFILE_VERSION)
+	{
+		error = "unsupported profile version " + std::to_string(version);
+		return false;
+	}
+
+	std::unordered_map<std::string, FunctionProfile> profiles;
+	std::string name;
+	unsigned numCounters = 0;
+	FunctionProfile profile;
+	while (file >> name >> profile.mBlocks >> numCounters)
+	{
+		profile.mCounts.resize(numCounters);
+		for (auto& count : profile.mCounts)
+		{
+			if (!(file >> count))
+			{
+				error = "counts for '" + name + "' are cut off";
+				return false;
+			}
+		}
+		profiles[name] = profile;
+	}
+	if (!file.eof())
+	{
+		error = "bad entry after '" + name + "'";
+		return false;
+	}
+
+	for (auto& F : module)
+	{
+		if (F.isDeclaration())
+		{
+			continue;
+		}
+
+		auto iter = profiles.find(F.getName().str());
+		if (iter == profiles.end())
+		{
+			continue;
+		}
+
+		unsigned blocks = 0;
+		unsigned counters = countCounters(F, blocks);
+		if (blocks != iter->second.mBlocks || counters != iter->second.mCounts.size())
+		{
+			errs() << fileName << ": warning: '" << F.getName()
+				<< "' has changed since the profile was made; ignoring it\n";
+			continue;
+		}
+		annotateFunction(F, iter->second);
+	}
+
+	return true;
+}
+
+} // opt
+} // uscc
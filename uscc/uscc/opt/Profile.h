@@ -0,0 +1,45 @@
+//
+//  Profile.h
+//  uscc
+//
+//  Declares profile-guided optimization support. An instrumented
+//  program counts how often each block runs and which way each
+//  conditional branch goes, and writes the counts to a file when
+//  it exits. A later compile of the same source reads them back
+//  as branch weights.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#pragma once
+#include <string>
+
+namespace llvm
+{
+	class Module;
+}
+
+namespace uscc
+{
+namespace opt
+{
+
+// Adds counters to every function in module, and a destructor that
+// writes them to fileName when the program exits. This has to be
+// done before optimizing, on the IR as it was emitted.
+void instrumentProfile(llvm::Module& module, const std::string& fileName);
+
+// Reads the counts an instrumented build wrote to fileName, and adds
+// them to module (emitted from the same source, before optimizing) as
+// branch weights, and as inlinehint/cold attributes on functions that
+// are called a lot/never. Functions that changed since the profile was
+// made are left alone. Returns false, and sets error, if the file
+// can't be read.
+bool useProfile(llvm::Module& module, const std::string& fileName, std::string& error);
+
+} // opt
+} // uscc
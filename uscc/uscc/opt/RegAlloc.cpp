@@ -22,6 +22,8 @@
 //  See LICENSE.TXT for details.
 //---------------------------------------------------------
 
+#include "Passes.h"
+#include "Trace.h"
 #include "llvm/CodeGen/Passes.h"
 #include "../lib/CodeGen/AllocationOrder.h"
 #include "../lib/CodeGen/LiveDebugVariables.h"
@@ -34,6 +36,7 @@
 #include "llvm/CodeGen/LiveRegMatrix.h"
 #include "llvm/CodeGen/LiveStackAnalysis.h"
 #include "llvm/CodeGen/MachineBlockFrequencyInfo.h"
+#include "llvm/CodeGen/MachineFrameInfo.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include "llvm/CodeGen/MachineInstr.h"
 #include "llvm/CodeGen/MachineLoopInfo.h"
@@ -43,15 +46,17 @@
 #include "llvm/PassAnalysisSupport.h"
 #undef DEBUG
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetInstrInfo.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetRegisterInfo.h"
+#include <chrono>
 #include <cstdlib>
 #include <queue>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
-#include <iostream>
 #include <algorithm>
 
 using namespace llvm;
@@ -63,16 +68,29 @@ static FunctionPass* createUSCCRegisterAllocator();
 static RegisterRegAlloc usccRegAlloc("uscc", "USCC register allocator",
 									  createUSCCRegisterAllocator);
 
-size_t NUM_COLORS = 4;
+static RegisterPass<uscc::opt::RegAllocConfig> usccRegAllocConfig("uscc-regalloc-config",
+									"USCC register allocator settings", false, true);
 
 namespace {
 	// map that keep track of the ordering of removed LiveInterval
-	std::map<LiveInterval*, int> removeIdxMap;
+	typedef std::map<LiveInterval*, int> RemoveOrderMap;
 
 	struct CompSpillWeight {
+		explicit CompSpillWeight(const RemoveOrderMap* order = nullptr)
+		: Order(order) { }
+
+		// Intervals that never made it into the graph (e.g. the ones created
+		// by spilling) are ordered as if they had been removed first
+		int position(LiveInterval *LI) const {
+			RemoveOrderMap::const_iterator iter = Order->find(LI);
+			return iter != Order->end() ? iter->second : 0;
+		}
+
 		bool operator()(LiveInterval *A, LiveInterval *B) const {
-			return removeIdxMap[A] < removeIdxMap[B];
+			return position(A) < position(B);
 		}
+
+		const RemoveOrderMap* Order;
 	};
 }
 
@@ -82,12 +100,15 @@ namespace {
 	class InterferenceGraph {
 	public:
 		std::vector<LiveInterval*> vertex;
+		// number of colors (K) available to each vertex's register class
+		std::vector<unsigned> colors;
 		std::vector<bool> removed;
 		int removed_counter = 0;
 		std::vector<std::set<int>> edges;
 
-		void add(LiveInterval* VirtReg) {
+		void add(LiveInterval* VirtReg, unsigned numColors) {
 			vertex.push_back(VirtReg);
+			colors.push_back(numColors);
 			removed.push_back(false);
 			edges.push_back(std::set<int>());
 
@@ -120,12 +141,19 @@ namespace {
 			return removed[idx];
 		}
 
+		// A vertex is trivially colorable if it has fewer
+		// neighbors than there are registers in its class
+		bool isTriviallyColorable(int idx) {
+			return static_cast<unsigned>(degree(idx)) < colors[idx];
+		}
+
 		bool empty() {
 			return vertex.size() == removed_counter;
 		}
 
 		void clear() {
 			vertex.clear();
+			colors.clear();
 			removed.clear();
 			edges.clear();
 			removed_counter = 0;
@@ -140,6 +168,16 @@ namespace {
 		// PA6: Add any member variables needed
 		InterferenceGraph G;
 		
+		// Order in which intervals were removed while simplifying the graph
+		RemoveOrderMap RemoveIdx;
+		
+		// Cap on the number of colors for any register class (0 = no cap),
+		// read from RegAllocConfig at the start of each function
+		unsigned MaxColors;
+		
+		// Number of intervals spilled in the current function
+		unsigned NumSpills;
+		
 		// state
 		std::unique_ptr<Spiller> SpillerInstance;
 		std::priority_queue<LiveInterval*, std::vector<LiveInterval*>,
@@ -188,6 +226,12 @@ namespace {
 		bool spillInterferences(LiveInterval &VirtReg, unsigned PhysReg,
 							  SmallVectorImpl<unsigned> &SplitVRegs);
 		
+		// Number of colors (K) for the register class of VirtReg
+		unsigned getNumColors(const LiveInterval &VirtReg) const;
+		
+		// Number of reloads from spill slots in the allocated function
+		unsigned countReloads() const;
+		
 		void initGraph();
 		void simplifyGraph();
 		static char ID;
@@ -197,7 +241,10 @@ namespace {
 	
 } // end anonymous namespace
 
-RAUSCC::RAUSCC(): MachineFunctionPass(ID) {
+RAUSCC::RAUSCC(): MachineFunctionPass(ID)
+	, MaxColors(0)
+	, NumSpills(0)
+	, Queue(CompSpillWeight(&RemoveIdx)) {
 	initializeLiveDebugVariablesPass(*PassRegistry::getPassRegistry());
 	initializeLiveIntervalsPass(*PassRegistry::getPassRegistry());
 	initializeSlotIndexesPass(*PassRegistry::getPassRegistry());
@@ -240,7 +287,7 @@ void RAUSCC::releaseMemory() {
 	// PA6: Delete any member data stored for each function
 
 	G.clear();
-	removeIdxMap.clear();
+	RemoveIdx.clear();
 }
 
 
@@ -269,7 +316,6 @@ bool RAUSCC::spillInterferences(LiveInterval &VirtReg, unsigned PhysReg,
 	DEBUG(dbgs() << "spilling " << TRI->getName(PhysReg) <<
 		  " interferences with " << VirtReg << "\n");
 	assert(!Intfs.empty() && "expected interference");
-	std::cout << "Spilling "; std::cout.flush(); VirtReg.dump();
 	// Spill each interfering vreg allocated to PhysReg or an alias.
 	for (unsigned i = 0, e = Intfs.size(); i != e; ++i) {
 		LiveInterval &Spill = *Intfs[i];
@@ -285,6 +331,7 @@ bool RAUSCC::spillInterferences(LiveInterval &VirtReg, unsigned PhysReg,
 		// Spill the extracted interval.
 		LiveRangeEdit LRE(&Spill, SplitVRegs, *MF, *LIS, VRM);
 		spiller().spill(LRE);
+		++NumSpills;
 	}
 	return true;
 }
@@ -313,7 +360,8 @@ unsigned RAUSCC::selectOrSplit(LiveInterval &VirtReg,
 		switch (Matrix->checkInterference(VirtReg, PhysReg)) {
 			case LiveRegMatrix::IK_Free:
 				// PhysReg is available, allocate it.
-				std::cout << "Assigning to physical register: "; std::cout.flush(); VirtReg.dump();
+				DEBUG(dbgs() << "assigning " << VirtReg << " to " <<
+					  TRI->getName(PhysReg) << '\n');
 				return PhysReg;
 				
 			case LiveRegMatrix::IK_VirtReg:
@@ -341,11 +389,11 @@ unsigned RAUSCC::selectOrSplit(LiveInterval &VirtReg,
 	
 	// No other spill candidates were found, so spill the current VirtReg.
 	DEBUG(dbgs() << "spilling: " << VirtReg << '\n');
-	std::cout << "Spilling "; std::cout.flush(); VirtReg.dump();
 	if (!VirtReg.isSpillable())
 		return ~0u;
 	LiveRangeEdit LRE(&VirtReg, SplitVRegs, *MF, *LIS, VRM);
 	spiller().spill(LRE);
+	++NumSpills;
 	
 	// The live virtual register requesting allocation was spilled, so tell
 	// the caller not to allocate anything during this round.
@@ -356,11 +404,22 @@ bool RAUSCC::runOnMachineFunction(MachineFunction &mf) {
 	DEBUG(dbgs() << "********** USCC REGISTER ALLOCATION **********\n"
 		  << "********** Function: "
 		  << mf.getName() << '\n');
-	std::cout << "********** USCC REGISTER ALLOCATION **********\n";
-	std::string funcName(mf.getName());
-	std::cout << "********** Function: " << funcName << '\n';
-	std::cout << "NUM_COLORS=" << NUM_COLORS << '\n';
 	MF = &mf;
+	uscc::opt::TraceSpan span("regalloc", mf.getName().str());
+	MaxColors = 0;
+	std::vector<uscc::opt::RegAllocStats>* statsOut = nullptr;
+	if (uscc::opt::RegAllocConfig* config = getAnalysisIfAvailable<uscc::opt::RegAllocConfig>()) {
+		MaxColors = config->mMaxColors;
+		statsOut = config->mStats;
+	}
+	
+	// Only pay for timing and the post-allocation scan if someone asked
+	std::chrono::steady_clock::time_point startTime;
+	if (statsOut) {
+		startTime = std::chrono::steady_clock::now();
+	}
+	NumSpills = 0;
+	
 	RegAllocBase::init(getAnalysis<VirtRegMap>(),
 					   getAnalysis<LiveIntervals>(),
 					   getAnalysis<LiveRegMatrix>());
@@ -372,6 +431,21 @@ bool RAUSCC::runOnMachineFunction(MachineFunction &mf) {
 	SpillerInstance.reset(createInlineSpiller(*this, *MF, *VRM));
 	
 	initGraph();
+	
+	uscc::opt::RegAllocStats stats;
+	if (statsOut) {
+		stats.mFunction = mf.getName();
+		stats.mVertices = static_cast<unsigned>(G.vertex.size());
+		for (size_t v_idx = 0; v_idx < G.vertex.size(); v_idx ++) {
+			unsigned degree = static_cast<unsigned>(G.degree(v_idx));
+			stats.mEdges += degree;
+			stats.mMaxDegree = std::max(stats.mMaxDegree, degree);
+		}
+		// every edge was counted from both ends
+		stats.mEdges /= 2;
+	}
+	unsigned numVirtRegs = MRI->getNumVirtRegs();
+	
 	simplifyGraph();
 	
 	allocatePhysRegs();
@@ -379,10 +453,46 @@ bool RAUSCC::runOnMachineFunction(MachineFunction &mf) {
 	// Diagnostic output before rewriting
 	DEBUG(dbgs() << "Post alloc VirtRegMap:\n" << *VRM << "\n");
 	
+	if (statsOut) {
+		stats.mSpills = NumSpills;
+		stats.mReloads = countReloads();
+		// Spilling replaces an interval with new (smaller) virtual registers
+		stats.mSplits = MRI->getNumVirtRegs() - numVirtRegs;
+		stats.mTimeMs = std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - startTime).count();
+		statsOut->push_back(stats);
+	}
+	
 	releaseMemory();
 	return true;
 }
 
+// K is the number of allocatable registers in the class (after reserved
+// registers are taken out), optionally capped by --num-colors
+unsigned RAUSCC::getNumColors(const LiveInterval &VirtReg) const {
+	unsigned K = RegClassInfo.getNumAllocatableRegs(MRI->getRegClass(VirtReg.reg));
+	if (MaxColors != 0 && MaxColors < K) {
+		K = MaxColors;
+	}
+	return K;
+}
+
+// Reloads are the loads the spiller inserted from spill slots
+unsigned RAUSCC::countReloads() const {
+	const TargetInstrInfo* TII = MF->getTarget().getInstrInfo();
+	const MachineFrameInfo* MFI = MF->getFrameInfo();
+	unsigned reloads = 0;
+	for (const MachineBasicBlock& MBB : *MF) {
+		for (const MachineInstr& MI : MBB) {
+			int FI = 0;
+			if (TII->isLoadFromStackSlot(&MI, FI) && MFI->isSpillSlotObjectIndex(FI)) {
+				++reloads;
+			}
+		}
+	}
+	return reloads;
+}
+
 // Build an interference graph
 void RAUSCC::initGraph() {
 	// PA6: Implement
@@ -392,7 +502,7 @@ void RAUSCC::initGraph() {
 		if (MRI->reg_nodbg_empty(Reg))
 			continue;
 		LiveInterval *VirtReg = &LIS->getInterval(Reg);
-		G.add(VirtReg);
+		G.add(VirtReg, getNumColors(*VirtReg));
 	}
 }
 
@@ -412,12 +522,12 @@ void RAUSCC::simplifyGraph() {
 					continue;
 				}
 
-				if (G.degree(v_idx) < NUM_COLORS) {
-					std::cout << "Remove candidate neighbors = "<< G.degree(v_idx) << std::endl; 
-					G.vertex[v_idx]->dump();
+				if (G.isTriviallyColorable(v_idx)) {
+					DEBUG(dbgs() << "remove candidate (" << G.degree(v_idx) <<
+						  " neighbors): " << *G.vertex[v_idx] << '\n');
 
 					G.remove(v_idx);
-					removeIdxMap[G.vertex[v_idx]] = removeIdx;
+					RemoveIdx[G.vertex[v_idx]] = removeIdx;
 					removeIdx ++;
 					flag = true;
 				}
@@ -441,11 +551,11 @@ void RAUSCC::simplifyGraph() {
 			}
 		}
 
-		std::cout << "Spill candidate neighbors = "<< G.degree(toRemove) << std::endl; 
-		G.vertex[toRemove]->dump();
+		DEBUG(dbgs() << "spill candidate (" << G.degree(toRemove) <<
+			  " neighbors): " << *G.vertex[toRemove] << '\n');
 
 		G.remove(toRemove);
-		removeIdxMap[G.vertex[toRemove]] = removeIdx;
+		RemoveIdx[G.vertex[toRemove]] = removeIdx;
 		removeIdx ++;
 	}
 }
@@ -453,3 +563,39 @@ void RAUSCC::simplifyGraph() {
 FunctionPass* createUSCCRegisterAllocator() {
 	return new RAUSCC();
 }
+
+void uscc::opt::useUSCCRegisterAllocator()
+{
+	RegisterRegAlloc::setDefault(createUSCCRegisterAllocator);
+}
+
+uscc::opt::RegAllocConfig::RegAllocConfig(unsigned maxColors,
+										   std::vector<RegAllocStats>* stats)
+: ImmutablePass(ID)
+, mMaxColors(maxColors)
+, mStats(stats)
+{
+	
+}
+
+// Writes the collected statistics as a JSON document
+void uscc::opt::writeRegAllocStats(const std::vector<RegAllocStats>& stats,
+								   raw_ostream& out)
+{
+	out << "{\n  \"functions\": [";
+	for (size_t i = 0; i < stats.size(); i++) {
+		const RegAllocStats& s = stats[i];
+		out << (i == 0 ? "\n" : ",\n");
+		out << "    { \"name\": \"" << s.mFunction << "\"";
+		out << ", \"vertices\": " << s.mVertices;
+		out << ", \"edges\": " << s.mEdges;
+		out << ", \"maxDegree\": " << s.mMaxDegree;
+		out << ", \"spills\": " << s.mSpills;
+		out << ", \"reloads\": " << s.mReloads;
+		out << ", \"splits\": " << s.mSplits;
+		out << ", \"timeMs\": " << format("%.3f", s.mTimeMs) << " }";
+	}
+	out << "\n  ]\n}\n";
+}
+
+char uscc::opt::RegAllocConfig::ID = 0;
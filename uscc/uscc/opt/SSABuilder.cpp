@@ -13,6 +13,7 @@
 //---------------------------------------------------------
 
 #include "SSABuilder.h"
+#include "MemReport.h"
 #include "../parse/Symbols.h"
 
 #pragma clang diagnostic push
@@ -43,21 +44,19 @@ void SSABuilder::reset()
 	
 	// reset mVarDefs
 	for (auto varDef : mVarDefs) {
-		if (varDef.second) {
-			varDef.second->clear();
-		}
+		delete varDef.second;
 	}
 	mVarDefs.clear();
 
 	// reset mIncompletePhis
 	for (auto incPhi : mIncompletePhis) {
-		if (incPhi.second) {
-			incPhi.second->clear();
-		}
+		delete incPhi.second;
 	}
 	mIncompletePhis.clear();
 
 	mSealedBlocks.clear();
+	
+	mRemovedPhis = 0;
 }
 
 // For a specific variable in a specific basic block, write its value
@@ -65,6 +64,7 @@ void SSABuilder::writeVariable(Identifier* var, BasicBlock* block, Value* value)
 {
 	// PA4 
 
+	MemScope memScope(MemTag::SSA);
 	(*(mVarDefs[block]))[var] = value;
 }
 
@@ -87,8 +87,11 @@ void SSABuilder::addBlock(BasicBlock* block, bool isSealed /* = false */)
 {
 	// PA4 
 
-	mVarDefs[block] = new SubMap();
-	mIncompletePhis[block] = new SubPHI();
+	{
+		MemScope memScope(MemTag::SSA);
+		mVarDefs[block] = new SubMap();
+		mIncompletePhis[block] = new SubPHI();
+	}
 	if (isSealed) {
 		sealBlock(block);
 	}
@@ -103,6 +106,7 @@ void SSABuilder::sealBlock(llvm::BasicBlock* block)
 	for (auto& incPhi: *mIncompletePhis[block]) {
 		addPhiOperands(incPhi.first, incPhi.second);
 	}
+	MemScope memScope(MemTag::SSA);
 	mSealedBlocks.insert(block);
 }
 
@@ -123,6 +127,7 @@ Value* SSABuilder::readVariableRecursive(Identifier* var, BasicBlock* block)
 			phiNode = PHINode::Create(var->llvmType(), 0, "", &(block->front()));
 		}
 
+		MemScope memScope(MemTag::SSA);
 		(*(mIncompletePhis[block]))[var] = phiNode;
 		retVal = phiNode;
 	}
@@ -199,6 +204,7 @@ Value* SSABuilder::tryRemoveTrivialPhi(llvm::PHINode* phi)
 
 	// remove phi inst from basic block
 	phi->eraseFromParent();
+	mRemovedPhis++;
 
 	// recursively remove trivial phi inst
 	// in old version of LLVM, replaceAllUsesWith would not empty the use-def chain
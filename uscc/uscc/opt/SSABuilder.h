@@ -42,6 +42,15 @@ namespace opt
 class SSABuilder
 {
 public:
+	SSABuilder()
+	: mRemovedPhis(0)
+	{ }
+	
+	~SSABuilder()
+	{
+		reset();
+	}
+	
 	// Called when a new function is started to clear out all the data
 	void reset();
 	
@@ -59,6 +68,12 @@ public:
 	// This is called when a block is "sealed" which means it will not have any
 	// further predecessors added. It will complete any PHI nodes (if necessary)
 	void sealBlock(llvm::BasicBlock* block);
+	
+	// Number of trivial phis removed since the last reset
+	unsigned getRemovedPhis() const
+	{
+		return mRemovedPhis;
+	}
 private:
 	// Helper functions
 	
@@ -82,6 +97,9 @@ private:
 	
 	// Set of all the sealed blocks in the current function
 	std::unordered_set<llvm::BasicBlock*> mSealedBlocks;
+	
+	// Trivial phis removed in the current function
+	unsigned mRemovedPhis;
 };
 	
 } // opt
@@ -0,0 +1,195 @@
+//
+//  TailRecursion.cpp
+//  uscc
+//
+//  Implements tail recursion elimination. A call a function
+//  makes to itself right before returning is turned into a
+//  branch back to the top of the function, with phis for
+//  the arguments. Any other calls in tail position are
+//  marked as tail calls, so the code generator can emit
+//  them as jumps.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/BasicBlock.h>
+#pragma clang diagnostic pop
+#include <vector>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+// Returns the call whose result is returned by BB's terminator, or null.
+// This is either a call right before a return, or a call right before a
+// branch to a block that only returns (the call's value, through a phi).
+static CallInst* findTailCall(BasicBlock& BB)
+{
+	TerminatorInst* term = BB.getTerminator();
+	if (term == nullptr || &BB.front() == term)
+	{
+		return nullptr;
+	}
+
+	CallInst* call = dyn_cast<CallInst>(--BasicBlock::iterator(term));
+	if (call == nullptr)
+	{
+		return nullptr;
+	}
+
+	ReturnInst* ret = dyn_cast<ReturnInst>(term);
+	if (ret == nullptr)
+	{
+		BranchInst* br = dyn_cast<BranchInst>(term);
+		if (br == nullptr || br->isConditional())
+		{
+			return nullptr;
+		}
+
+		BasicBlock* succ = br->getSuccessor(0);
+		ret = dyn_cast<ReturnInst>(succ->getTerminator());
+		if (ret == nullptr)
+		{
+			return nullptr;
+		}
+
+		if (PHINode* phi = dyn_cast<PHINode>(&succ->front()))
+		{
+			// The return block can only have the phi that is returned
+			if (succ->size() != 2 || ret->getReturnValue() != phi ||
+				phi->getIncomingValueForBlock(&BB) != call)
+			{
+				return nullptr;
+			}
+			return call;
+		}
+		else if (&succ->front() != ret)
+		{
+			return nullptr;
+		}
+	}
+
+	Value* retVal = ret->getReturnValue();
+	if (retVal == nullptr ? !call->getType()->isVoidTy() : retVal != call)
+	{
+		return nullptr;
+	}
+
+	return call;
+}
+
+bool TailRecursion::runOnFunction(Function& F)
+{
+	bool changed = false;
+
+	// If there's a stack array, its address could be passed to the call.
+	// Then the callee would need its own frame, so leave everything alone.
+	for (auto& BB : F)
+	{
+		for (auto& I : BB)
+		{
+			if (isa<AllocaInst>(&I))
+			{
+				return false;
+			}
+		}
+	}
+
+	std::vector<CallInst*> selfCalls;
+	for (auto& BB : F)
+	{
+		CallInst* call = findTailCall(BB);
+		if (call == nullptr)
+		{
+			continue;
+		}
+
+		if (call->getCalledFunction() == &F && !F.isVarArg())
+		{
+			selfCalls.push_back(call);
+		}
+		else if (!call->isTailCall())
+		{
+			call->setTailCall();
+			changed = true;
+			if (OptStatsConfig* stats = getAnalysisIfAvailable<OptStatsConfig>())
+			{
+				stats->count(F, "tailrec", "tail calls marked", 1);
+			}
+		}
+	}
+
+	if (selfCalls.empty())
+	{
+		return changed;
+	}
+	
+	if (OptStatsConfig* stats = getAnalysisIfAvailable<OptStatsConfig>())
+	{
+		stats->count(F, "tailrec", "recursive calls removed",
+					 static_cast<unsigned>(selfCalls.size()));
+	}
+
+	// The old entry block becomes the loop header,
+	// and a new entry block branches into it
+	LLVMContext& ctx = F.getContext();
+	BasicBlock* header = &F.getEntryBlock();
+	header->setName("tailrecurse");
+	BasicBlock* entry = BasicBlock::Create(ctx, "entry", &F, header);
+	BranchInst::Create(header, entry);
+
+	// Each argument now comes from a phi in the header
+	std::vector<PHINode*> argPhis;
+	for (auto arg = F.arg_begin(); arg != F.arg_end(); ++arg)
+	{
+		PHINode* phi = PHINode::Create(arg->getType(), selfCalls.size() + 1,
+									   arg->getName() + ".tr", &header->front());
+		arg->replaceAllUsesWith(phi);
+		phi->addIncoming(arg, entry);
+		argPhis.push_back(phi);
+	}
+
+	// Replace each recursive call with a branch to the header
+	for (CallInst* call : selfCalls)
+	{
+		BasicBlock* BB = call->getParent();
+		TerminatorInst* term = BB->getTerminator();
+
+		for (unsigned i = 0; i < argPhis.size(); i++)
+		{
+			argPhis[i]->addIncoming(call->getArgOperand(i), BB);
+		}
+
+		if (!isa<ReturnInst>(term))
+		{
+			term->getSuccessor(0)->removePredecessor(BB);
+		}
+		term->eraseFromParent();
+		call->eraseFromParent();
+		BranchInst::Create(header, BB);
+	}
+
+	return true;
+}
+
+void TailRecursion::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// Nothing is preserved, since this adds a loop to the CFG
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::TailRecursion::ID = 0;
@@ -0,0 +1,230 @@
+//
+//  Trace.cpp
+//  uscc
+//
+//  Implements the timeline tracing for --trace, and the
+//  passes that record how long each pass takes per function.
+//
+//  Spans are written as "complete" (ph X) events, each on the
+//  thread it happened on, with the function it was for (if any)
+//  in its args.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Trace.h"
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#pragma clang diagnostic pop
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+bool Trace::sEnabled = false;
+
+namespace
+{
+
+struct TraceEvent
+{
+	std::string mName;
+	std::string mFunction;
+	uint64_t mStart;
+	uint64_t mEnd;
+	unsigned mThread;
+};
+
+// Everything here is guarded by sMutex, except sOrigin, which
+// is only set by start
+std::mutex sMutex;
+std::string sFileName;
+std::chrono::steady_clock::time_point sOrigin;
+std::vector<TraceEvent> sEvents;
+// Small numbers for the threads, in the order they show up
+std::map<std::thread::id, unsigned> sThreads;
+
+void writeEscaped(std::ostream& out, const std::string& str)
+{
+	for (char c : str)
+	{
+		if (c == '"' || c == '\\')
+		{
+			out << '\\';
+		}
+		out << c;
+	}
+}
+
+}
+
+void Trace::start(const std::string& fileName)
+{
+	sFileName = fileName;
+	sOrigin = std::chrono::steady_clock::now();
+	sEvents.clear();
+	sThreads.clear();
+	sEnabled = true;
+}
+
+bool Trace::stop()
+{
+	sEnabled = false;
+
+	std::ofstream out(sFileName);
+	if (!out)
+	{
+		return false;
+	}
+
+	out << "{\"traceEvents\":[\n";
+	for (size_t i = 0; i < sEvents.size(); i++)
+	{
+		const TraceEvent& e = sEvents[i];
+		out << "{\"name\":\"";
+		writeEscaped(out, e.mName);
+		out << "\",\"cat\":\"uscc\",\"ph\":\"X\",\"ts\":" << e.mStart
+			<< ",\"dur\":" << e.mEnd - e.mStart << ",\"pid\":1,\"tid\":" << e.mThread;
+		if (!e.mFunction.empty())
+		{
+			out << ",\"args\":{\"function\":\"";
+			writeEscaped(out, e.mFunction);
+			out << "\"}";
+		}
+		out << (i + 1 < sEvents.size() ? "},\n" : "}\n");
+	}
+	out << "],\"displayTimeUnit\":\"ms\"}\n";
+
+	sEvents.clear();
+	return static_cast<bool>(out);
+}
+
+uint64_t Trace::now() noexcept
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - sOrigin).count());
+}
+
+void Trace::addSpan(const std::string& name, const std::string& function,
+					uint64_t start, uint64_t end)
+{
+	std::lock_guard<std::mutex> lock(sMutex);
+	auto thread = sThreads.insert(std::make_pair(std::this_thread::get_id(),
+												 static_cast<unsigned>(sThreads.size())));
+	TraceEvent e;
+	e.mName = name;
+	e.mFunction = function;
+	e.mStart = start;
+	e.mEnd = end;
+	e.mThread = thread.first->second;
+	sEvents.push_back(e);
+}
+
+TraceSpan::TraceSpan(const char* name, const std::string& function)
+: mName(name)
+, mStart(0)
+, mActive(Trace::enabled())
+{
+	if (mActive)
+	{
+		mFunction = function;
+		mStart = Trace::now();
+	}
+}
+
+TraceSpan::~TraceSpan()
+{
+	if (mActive && Trace::enabled())
+	{
+		Trace::addSpan(mName, mFunction, mStart, Trace::now());
+	}
+}
+
+void TraceSpan::setFunction(const std::string& function)
+{
+	if (mActive)
+	{
+		mFunction = function;
+	}
+}
+
+// Goes before and after a pass, to time it on each function. Analyses
+// the pass needs are scheduled in between, so they count toward it.
+struct TraceMark : public FunctionPass
+{
+	static char ID;
+	TraceMark(const char* name, TraceMark* begin = nullptr)
+	: FunctionPass(ID)
+	, mName(name)
+	, mBegin(begin)
+	, mStart(0)
+	{ }
+
+	virtual bool runOnFunction(Function& F) override
+	{
+		if (mBegin)
+		{
+			Trace::addSpan(mName, F.getName().str(), mBegin->mStart, Trace::now());
+		}
+		else
+		{
+			mStart = Trace::now();
+		}
+		return false;
+	}
+
+	virtual void getAnalysisUsage(AnalysisUsage& Info) const override
+	{
+		Info.setPreservesAll();
+	}
+
+	std::string mName;
+	TraceMark* mBegin;
+	uint64_t mStart;
+};
+
+void addTracedPass(legacy::PassManagerBase& pm, Pass* pass, const char* name)
+{
+	addTracedGroup(pm, name ? name : pass->getPassName(), std::vector<Pass*>(1, pass));
+}
+
+void addTracedGroup(legacy::PassManagerBase& pm, const char* name,
+					const std::vector<Pass*>& passes)
+{
+	if (!Trace::enabled())
+	{
+		for (Pass* pass : passes)
+		{
+			pm.add(pass);
+		}
+		return;
+	}
+
+	TraceMark* begin = new TraceMark(name);
+	pm.add(begin);
+	for (Pass* pass : passes)
+	{
+		pm.add(pass);
+	}
+	pm.add(new TraceMark(begin->mName.c_str(), begin));
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::TraceMark::ID = 0;
@@ -0,0 +1,74 @@
+//
+//  Trace.h
+//  uscc
+//
+//  Declares the compiler's timeline tracing (--trace). Spans of
+//  time, such as parsing a function or running a pass on it, are
+//  recorded and written out in Chrome's trace event format, which
+//  chrome://tracing and Perfetto can load.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace uscc
+{
+namespace opt
+{
+
+class Trace
+{
+public:
+	// Starts recording. Call this before any other threads are started.
+	static void start(const std::string& fileName);
+
+	// Writes the recorded spans to the file given to start, and stops
+	// recording. Returns false if the file can't be written.
+	static bool stop();
+
+	static bool enabled() noexcept
+	{
+		return sEnabled;
+	}
+
+	// Microseconds since start
+	static uint64_t now() noexcept;
+
+	// Records a span on the current thread. function may be empty.
+	static void addSpan(const std::string& name, const std::string& function,
+						uint64_t start, uint64_t end);
+
+private:
+	static bool sEnabled;
+};
+
+// Records a span from when it's constructed to when it's destroyed
+// (if tracing is on)
+class TraceSpan
+{
+public:
+	TraceSpan(const char* name, const std::string& function = std::string());
+	~TraceSpan();
+
+	// For when the function isn't known yet at the start
+	void setFunction(const std::string& function);
+
+private:
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+	const char* mName;
+	std::string mFunction;
+	uint64_t mStart;
+	bool mActive;
+};
+
+} // opt
+} // uscc
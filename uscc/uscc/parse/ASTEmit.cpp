@@ -14,6 +14,9 @@
 
 #include "ASTNodes.h"
 #include "Emitter.h"
+#include "../opt/IRCache.h"
+#include "../opt/Passes.h"
+#include "../opt/Trace.h"
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wconversion"
@@ -39,29 +42,8 @@ using namespace llvm;
 // Program/Functions
 AST_EMIT(ASTProgram)
 {
-	ctx.mModule = new Module("main", ctx.mGlobal);
-	
-	// Write the global string table
-	ctx.mStrings.emitIR(ctx);
-	
-	// Emit declaration for stdlib "printf", if we need it
-	if (ctx.mPrintfIdent != nullptr)
-	{
-		std::vector<llvm::Type*> printfArgs;
-		printfArgs.push_back(llvm::Type::getInt8PtrTy(ctx.mGlobal));
-		
-		FunctionType* printfType = FunctionType::get(llvm::Type::getInt32Ty(ctx.mGlobal),
-													 printfArgs, true);
-		
-		Function* func = Function::Create(printfType, GlobalValue::LinkageTypes::ExternalLinkage,
-										  "printf", ctx.mModule);
-		func->setCallingConv(CallingConv::C);
-		
-		// Map the printf ident to this function
-		ctx.mPrintfIdent->setAddress(func);
-	}
-	
-	// Emit code for all the functions
+	// Strings and printf are emitted when first used,
+	// so all that's left is to emit the functions
 	for (auto f : mFuncs)
 	{
 		f->emitIR(ctx);
@@ -73,6 +55,7 @@ AST_EMIT(ASTProgram)
 
 AST_EMIT(ASTFunction)
 {
+	uscc::opt::TraceSpan span("emit", mIdent.getName());
 	FunctionType* funcType = nullptr;
 	
 	// First get the return type (there's only three choices)
@@ -117,11 +100,39 @@ AST_EMIT(ASTFunction)
 	// Map the ident to this function
 	mIdent.setAddress(ctx.mFunc);
 	
+	// If this function is unchanged since it was cached, reuse that IR
+	if (ctx.mCache)
+	{
+		if (ctx.mCache->load(mFingerprint, ctx.mFunc))
+		{
+			ctx.mFunc->setCallingConv(CallingConv::C);
+			ctx.mCachedFuncs.insert(ctx.mFunc);
+			return ctx.mFunc;
+		}
+		ctx.mEmittedFuncs.push_back(std::make_pair(ctx.mFunc, mFingerprint));
+	}
+	
 	// Create the entry basic block
 	ctx.mBlock = BasicBlock::Create(ctx.mGlobal, "entry", ctx.mFunc);
 	// Add and seal this block
 	ctx.mSSA.addBlock(ctx.mBlock, true);
 	
+	if (ctx.mDIBuilder)
+	{
+		ctx.beginDebugFunction(mLoc.getLine());
+	}
+	CodeContext::DebugMark entryMark = ctx.markDebugLoc();
+	
+	// Tell the runtime we're in this function (--instrument-functions)
+	unsigned funcId = ctx.mNextFuncId;
+	if (ctx.mInstrument)
+	{
+		ctx.mNextFuncId++;
+		IRBuilder<> builder(ctx.mBlock);
+		builder.CreateCall2(ctx.getEnterHook(), builder.getInt32(funcId),
+							builder.CreateGlobalStringPtr(mIdent.getName()));
+	}
+	
 	// If we have arguments, we need to set the name/value of them
 	if (mArgs.size() > 0)
 	{
@@ -150,11 +161,34 @@ AST_EMIT(ASTFunction)
 	ctx.mFunc->setCallingConv(CallingConv::C);
 	
 	// Add all the declarations for variables created in this function
-	mScopeTable.emitIR(ctx);
+	mScopeTable->emitIR(ctx);
 	
 	// Now emit the body
 	mBody->emitIR(ctx);
 	
+	// ...and when we leave it, from any return
+	if (ctx.mInstrument)
+	{
+		Value* idValue = ConstantInt::get(llvm::Type::getInt32Ty(ctx.mGlobal), funcId);
+		for (auto& bb : *ctx.mFunc)
+		{
+			if (ReturnInst* ret = dyn_cast_or_null<ReturnInst>(bb.getTerminator()))
+			{
+				CallInst::Create(ctx.getExitHook(), idValue, "", ret);
+			}
+		}
+	}
+	
+	// Whatever isn't part of a statement (such as the arguments)
+	// is on the function's line
+	ctx.setDebugLoc(entryMark, mLoc);
+	
+	if (ctx.mStats)
+	{
+		opt::countStat(*ctx.mStats, mIdent.getName(), "ssa", "trivial phis removed",
+					   ctx.mSSA.getRemovedPhis());
+	}
+	
 	return ctx.mFunc;
 }
 
@@ -185,6 +219,16 @@ AST_EMIT(ASTBadExpr)
 	return nullptr;
 }
 
+void ASTExpr::emitBranch(CodeContext& ctx, BasicBlock* trueBlock,
+						 BasicBlock* falseBlock) noexcept
+{
+	Value* val = emitIR(ctx);
+	
+	IRBuilder<> build(ctx.mBlock);
+	Value* cond = build.CreateICmpNE(val, Constant::getNullValue(val->getType()), "tobool");
+	build.CreateCondBr(cond, trueBlock, falseBlock);
+}
+
 AST_EMIT(ASTLogicalAnd)
 {
 	// This is extremely similar to logical or
@@ -262,6 +306,23 @@ AST_EMIT(ASTLogicalAnd)
 	return build.CreateZExt(zextVal, llvm::Type::getInt32Ty(ctx.mGlobal));
 }
 
+// As a condition, the LHS and RHS branch straight to the targets
+// (short-circuiting to falseBlock), so there's no phi
+void ASTLogicalAnd::emitBranch(CodeContext& ctx, BasicBlock* trueBlock,
+							   BasicBlock* falseBlock) noexcept
+{
+	BasicBlock* rhsBlock = BasicBlock::Create(ctx.mGlobal, "and.rhs", ctx.mFunc);
+	ctx.mSSA.addBlock(rhsBlock);
+	
+	mLHS->emitBranch(ctx, rhsBlock, falseBlock);
+	
+	// Every branch to the RHS came from the LHS
+	ctx.mSSA.sealBlock(rhsBlock);
+	
+	ctx.mBlock = rhsBlock;
+	mRHS->emitBranch(ctx, trueBlock, falseBlock);
+}
+
 AST_EMIT(ASTLogicalOr)
 {
 	// Create the block for the RHS
@@ -337,16 +398,74 @@ AST_EMIT(ASTLogicalOr)
 	return build.CreateZExt(zextVal, llvm::Type::getInt32Ty(ctx.mGlobal));
 }
 
-AST_EMIT(ASTBinaryCmpOp)
+// Same as ASTLogicalAnd, but short-circuits to trueBlock
+void ASTLogicalOr::emitBranch(CodeContext& ctx, BasicBlock* trueBlock,
+							  BasicBlock* falseBlock) noexcept
+{
+	BasicBlock* rhsBlock = BasicBlock::Create(ctx.mGlobal, "lor.rhs", ctx.mFunc);
+	ctx.mSSA.addBlock(rhsBlock);
+	
+	mLHS->emitBranch(ctx, trueBlock, rhsBlock);
+	
+	// Every branch to the RHS came from the LHS
+	ctx.mSSA.sealBlock(rhsBlock);
+	
+	ctx.mBlock = rhsBlock;
+	mRHS->emitBranch(ctx, trueBlock, falseBlock);
+}
+
+// Returns the char that expr promotes to an int, if it does
+static std::shared_ptr<ASTExpr> promotedChar(std::shared_ptr<ASTExpr> expr)
+{
+	if (auto toInt = std::dynamic_pointer_cast<ASTToIntExpr>(expr))
+	{
+		return toInt->getChild();
+	}
+	return nullptr;
+}
+
+// Returns the value of expr as a char constant, if it's a constant
+// that fits in a char. The AST node itself stays an int.
+static Value* charConstant(CodeContext& ctx, std::shared_ptr<ASTExpr> expr)
+{
+	auto constant = std::dynamic_pointer_cast<ASTConstantExpr>(expr);
+	if (constant && constant->getValue() >= -128 && constant->getValue() <= 127)
+	{
+		return ConstantInt::getSigned(llvm::Type::getInt8Ty(ctx.mGlobal),
+									  constant->getValue());
+	}
+	return nullptr;
+}
+
+Value* ASTBinaryCmpOp::emitCompare(CodeContext& ctx) noexcept
 {
 	Value* retVal = nullptr;
 	
-	// PA3 
+	// Chars are promoted to int before they're compared, but comparing
+	// the chars themselves gives the same result without the sexts
+	Value* lhs = nullptr;
+	Value* rhs = nullptr;
+	auto lhsChar = promotedChar(mLHS);
+	auto rhsChar = promotedChar(mRHS);
+	if (lhsChar && (rhsChar || charConstant(ctx, mRHS)))
+	{
+		lhs = lhsChar->emitIR(ctx);
+		rhs = rhsChar ? rhsChar->emitIR(ctx) : charConstant(ctx, mRHS);
+	}
+	else if (rhsChar && charConstant(ctx, mLHS))
+	{
+		lhs = charConstant(ctx, mLHS);
+		rhs = rhsChar->emitIR(ctx);
+	}
+	else
+	{
+		lhs = mLHS->emitIR(ctx);
+		rhs = mRHS->emitIR(ctx);
+	}
+	
+	// The operands may have moved us to a new block
 	IRBuilder<> builder(ctx.mBlock);
 
-	Value* lhs = mLHS->emitIR(ctx);
-	Value* rhs = mRHS->emitIR(ctx);
-
 	switch (mOp) {
 		case scan::Token::EqualTo:
 			retVal = builder.CreateICmpEQ(lhs, rhs, "eq");
@@ -362,9 +481,27 @@ AST_EMIT(ASTBinaryCmpOp)
 			break;
 	}
 
+	return retVal;
+}
+
+AST_EMIT(ASTBinaryCmpOp)
+{
+	// PA3 
+	Value* retVal = emitCompare(ctx);
+	
+	IRBuilder<> builder(ctx.mBlock);
 	return builder.CreateZExt(retVal, llvm::Type::getInt32Ty(ctx.mGlobal));
 }
 
+void ASTBinaryCmpOp::emitBranch(CodeContext& ctx, BasicBlock* trueBlock,
+								BasicBlock* falseBlock) noexcept
+{
+	Value* cond = emitCompare(ctx);
+	
+	IRBuilder<> builder(ctx.mBlock);
+	builder.CreateCondBr(cond, trueBlock, falseBlock);
+}
+
 AST_EMIT(ASTBinaryMathOp)
 {
 	Value* retVal = nullptr;
@@ -415,6 +552,13 @@ AST_EMIT(ASTNotExpr)
 	return retVal;
 }
 
+void ASTNotExpr::emitBranch(CodeContext& ctx, BasicBlock* trueBlock,
+							BasicBlock* falseBlock) noexcept
+{
+	// Just swap the targets
+	mExpr->emitBranch(ctx, falseBlock, trueBlock);
+}
+
 // Factor -->
 AST_EMIT(ASTConstantExpr)
 {
@@ -434,7 +578,7 @@ AST_EMIT(ASTConstantExpr)
 
 AST_EMIT(ASTStringExpr)
 {
-	return mString->getValue();
+	return mString->getValue(ctx);
 }
 
 AST_EMIT(ASTIdentExpr)
@@ -492,14 +636,21 @@ AST_EMIT(ASTFuncExpr)
 	// Now call the function, and return it
 	Value* retVal = nullptr;
 	
+	// Only printf won't have an address (since it isn't defined in USC)
+	Value* callee = mIdent.getAddress();
+	if (callee == nullptr)
+	{
+		callee = ctx.getPrintf();
+	}
+	
 	IRBuilder<> build(ctx.mBlock);
 	if (mType != Type::Void)
 	{
-		retVal = build.CreateCall(mIdent.getAddress(), callList, "call");
+		retVal = build.CreateCall(callee, callList, "call");
 	}
 	else
 	{
-		retVal = build.CreateCall(mIdent.getAddress(), callList);
+		retVal = build.CreateCall(callee, callList);
 	}
 	
 	return retVal;
@@ -609,7 +760,9 @@ AST_EMIT(ASTCompoundStmt)
 
 	// stmt
 	for (auto& stmt : mStmts) {
+		auto mark = ctx.markDebugLoc();
 		stmt->emitIR(ctx);
+		ctx.setDebugLoc(mark, stmt->getLoc());
 	}
 	
 	return nullptr;
@@ -656,16 +809,14 @@ AST_EMIT(ASTIfStmt)
 	auto endBlock = BasicBlock::Create(ctx.mGlobal, "if.end", ctx.mFunc);
 	ctx.mSSA.addBlock(endBlock);
 
-	// append condition IR to current block
-	auto condVal = mExpr->emitIR(ctx);
-	IRBuilder<> builder(ctx.mBlock); // the mBlocks can change because of previous emitIR()
-	auto condBool = builder.CreateICmpNE(condVal, ctx.mZero);
+	// branch on the condition from the current block
 	if (mElseStmt) {
-		builder.CreateCondBr(condBool, thenBlock, elseBlock);
+		mExpr->emitBranch(ctx, thenBlock, elseBlock);
 	}
 	else {
-		builder.CreateCondBr(condBool, thenBlock, endBlock);
+		mExpr->emitBranch(ctx, thenBlock, endBlock);
 	}
+	IRBuilder<> builder(ctx.mBlock);
 	
 	// since we finish ifBlock, we can seal else/then block
 	ctx.mSSA.sealBlock(thenBlock);
@@ -710,14 +861,9 @@ AST_EMIT(ASTWhileStmt)
 	IRBuilder<> builder(ctx.mBlock);
 	builder.CreateBr(condBlock);
 
-	// emit IR for cond block
+	// emit IR for cond block, which branches to body or end
 	ctx.mBlock = condBlock;
-	auto condVal = mExpr->emitIR(ctx);
-
-	// conditonal branch from cond block
-	builder.SetInsertPoint(ctx.mBlock);
-	auto condBool = builder.CreateICmpNE(condVal, ctx.mZero);
-	builder.CreateCondBr(condBool, bodyBlock, endBlock);
+	mExpr->emitBranch(ctx, bodyBlock, endBlock);
 
 	// seal
 	ctx.mSSA.sealBlock(bodyBlock);
@@ -27,15 +27,16 @@ void ASTProgram::addFunction(shared_ptr<ASTFunction> func) noexcept
 void ASTFunction::addArg(shared_ptr<ASTArgDecl> arg) noexcept
 {
 	mArgs.push_back(arg);
+	mArgTypes.push_back(arg->getType());
 }
 
 // Returns true if the type passed in matches the argument
 // declaration for that particular argument
 bool ASTFunction::checkArgType(unsigned int argNum, Type type) const noexcept
 {
-	if (argNum > 0 && argNum <= mArgs.size())
+	if (argNum > 0 && argNum <= mArgTypes.size())
 	{
-		return mArgs[argNum - 1]->getType() == type;
+		return mArgTypes[argNum - 1] == type;
 	}
 	else
 	{
@@ -45,9 +46,9 @@ bool ASTFunction::checkArgType(unsigned int argNum, Type type) const noexcept
 
 Type ASTFunction::getArgType(unsigned int argNum) const noexcept
 {
-	if (argNum > 0 && argNum <= mArgs.size())
+	if (argNum > 0 && argNum <= mArgTypes.size())
 	{
-		return mArgs[argNum - 1]->getType();
+		return mArgTypes[argNum - 1];
 	}
 	else
 	{
@@ -60,3 +61,9 @@ void ASTFunction::setBody(shared_ptr<ASTCompoundStmt> body) noexcept
 {
 	mBody = body;
 }
+
+void ASTFunction::releaseBody() noexcept
+{
+	mBody.reset();
+	mArgs.clear();
+}
@@ -23,6 +23,8 @@
 #include <memory>
 #include <list>
 #include <vector>
+#include <cstdint>
+#include <cassert>
 
 #include "Types.h"
 #include "Symbols.h"
@@ -36,6 +38,7 @@ virtual llvm::Value* emitIR(CodeContext& ctx) noexcept override;
 namespace llvm
 {
 	class Value;
+	class BasicBlock;
 }
 
 namespace uscc
@@ -44,6 +47,34 @@ namespace parse
 {
 
 class CodeContext;
+
+// Where a statement or function starts in the source (for -g).
+// Packed into 32 bits, since every statement has one; lines past
+// 4194303 and columns past 1023 are clamped.
+class SourceLoc
+{
+public:
+	SourceLoc(unsigned line = 0, unsigned col = 0) noexcept
+	: mLine(line < MAX_LINE ? line : MAX_LINE)
+	, mCol(col < MAX_COL ? col : MAX_COL)
+	{ }
+	
+	unsigned getLine() const noexcept
+	{
+		return mLine;
+	}
+	
+	unsigned getCol() const noexcept
+	{
+		return mCol;
+	}
+private:
+	static const unsigned MAX_LINE = (1u << 22) - 1;
+	static const unsigned MAX_COL = (1u << 10) - 1;
+	
+	uint32_t mLine : 22;
+	uint32_t mCol : 10;
+};
 	
 class ASTNode
 {
@@ -79,7 +110,8 @@ public:
 	ASTFunction(Identifier& ident, Type returnType, SymbolTable::ScopeTable& scopeTable) noexcept
 	: mIdent(ident)
 	, mReturnType(returnType)
-	, mScopeTable(scopeTable)
+	, mScopeTable(&scopeTable)
+	, mFingerprint(0)
 	{ }
 	
 	// Add an argument to this function
@@ -88,6 +120,25 @@ public:
 	// Set the compound statement body
 	void setBody(std::shared_ptr<ASTCompoundStmt> body) noexcept;
 	
+	// Frees the body and arguments once the function has been emitted.
+	// The signature (return and argument types) is kept for callers.
+	void releaseBody() noexcept;
+	
+	SymbolTable::ScopeTable& getScopeTable() noexcept
+	{
+		assert(mScopeTable && "The function's scope has been released");
+		return *mScopeTable;
+	}
+	
+	// Gives up the function's scope, once the function has been emitted,
+	// so it can be freed (see SymbolTable::releaseScope). Returns it.
+	SymbolTable::ScopeTable* releaseScopeTable() noexcept
+	{
+		SymbolTable::ScopeTable* scope = mScopeTable;
+		mScopeTable = nullptr;
+		return scope;
+	}
+	
 	Type getReturnType() const noexcept
 	{
 		return mReturnType;
@@ -96,7 +147,7 @@ public:
 	// Returns the number of arguments
 	size_t getNumArgs() const noexcept
 	{
-		return mArgs.size();
+		return mArgTypes.size();
 	}
 	
 	// Returns true if the type passed in matches the argument
@@ -105,13 +156,45 @@ public:
 	
 	Type getArgType(unsigned int argNum) const noexcept;
 	
+	// Hash of this function's tokens and the signatures of the
+	// functions it calls. Used as the key for the IR cache.
+	void setFingerprint(uint64_t fingerprint) noexcept
+	{
+		mFingerprint = fingerprint;
+	}
+	
+	uint64_t getFingerprint() const noexcept
+	{
+		return mFingerprint;
+	}
+	
+	void setLoc(SourceLoc loc) noexcept
+	{
+		mLoc = loc;
+	}
+	
 	AST_DECL_PRINT_EMIT();
 private:
 	std::shared_ptr<ASTCompoundStmt> mBody;
 	std::vector<std::shared_ptr<ASTArgDecl>> mArgs;
+	// Argument types, which outlive mArgs
+	std::vector<Type> mArgTypes;
 	Identifier& mIdent;
-	SymbolTable::ScopeTable& mScopeTable;
+	// Null once released
+	SymbolTable::ScopeTable* mScopeTable;
 	Type mReturnType;
+	uint64_t mFingerprint;
+	SourceLoc mLoc;
+};
+
+// Receives each function as soon as it has been parsed.
+// Used for streaming compilation, so the whole AST never
+// has to be in memory at once.
+class FunctionSink
+{
+public:
+	virtual ~FunctionSink() { }
+	virtual void functionParsed(std::shared_ptr<ASTFunction> func) noexcept = 0;
 };
 
 class ASTArgDecl : public ASTNode
@@ -148,6 +231,13 @@ public:
 	{
 		return mType;
 	}
+	
+	// Emits this expression as a condition, branching to trueBlock
+	// if it's nonzero and falseBlock otherwise. By default this
+	// tests the value from emitIR, but comparisons and logical ops
+	// branch directly instead of making a boolean first.
+	virtual void emitBranch(CodeContext& ctx, llvm::BasicBlock* trueBlock,
+							llvm::BasicBlock* falseBlock) noexcept;
 protected:
 	// All expressions have a type
 	// (used for semantic evaluation)
@@ -202,6 +292,8 @@ public:
 	bool finalizeOp() noexcept;
 	
 	AST_DECL_PRINT_EMIT();
+	virtual void emitBranch(CodeContext& ctx, llvm::BasicBlock* trueBlock,
+							llvm::BasicBlock* falseBlock) noexcept override;
 private:
 	std::shared_ptr<ASTExpr> mLHS;
 	std::shared_ptr<ASTExpr> mRHS;
@@ -227,6 +319,8 @@ public:
 	bool finalizeOp() noexcept;
 	
 	AST_DECL_PRINT_EMIT();
+	virtual void emitBranch(CodeContext& ctx, llvm::BasicBlock* trueBlock,
+							llvm::BasicBlock* falseBlock) noexcept override;
 private:
 	std::shared_ptr<ASTExpr> mLHS;
 	std::shared_ptr<ASTExpr> mRHS;
@@ -256,7 +350,12 @@ public:
 	bool finalizeOp() noexcept;
 	
 	AST_DECL_PRINT_EMIT();
+	virtual void emitBranch(CodeContext& ctx, llvm::BasicBlock* trueBlock,
+							llvm::BasicBlock* falseBlock) noexcept override;
 private:
+	// Emits the comparison as an i1
+	llvm::Value* emitCompare(CodeContext& ctx) noexcept;
+	
 	scan::Token::Tokens mOp;
 	std::shared_ptr<ASTExpr> mLHS;
 	std::shared_ptr<ASTExpr> mRHS;
@@ -304,6 +403,8 @@ public:
 		mType = mExpr->getType();
 	}
 	AST_DECL_PRINT_EMIT();
+	virtual void emitBranch(CodeContext& ctx, llvm::BasicBlock* trueBlock,
+							llvm::BasicBlock* falseBlock) noexcept override;
 private:
 	std::shared_ptr<ASTExpr> mExpr;
 };
@@ -509,7 +610,18 @@ private:
 // Statement AST Nodes
 class ASTStmt : public ASTNode
 {
+public:
+	void setLoc(SourceLoc loc) noexcept
+	{
+		mLoc = loc;
+	}
 	
+	SourceLoc getLoc() const noexcept
+	{
+		return mLoc;
+	}
+private:
+	SourceLoc mLoc;
 };
 
 class ASTCompoundStmt : public ASTStmt
@@ -25,6 +25,11 @@
 
 #include "Emitter.h"
 #include "Parse.h"
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <cctype>
+#include <mutex>
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wconversion"
@@ -49,51 +54,561 @@
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Support//FileSystem.h>
 #include <llvm/Support/SourceMgr.h>
-#include <llvm/Support/CommandLine.h>
 #include <llvm/MC/SubtargetFeature.h>
+#include <llvm/MC/MCAsmBackend.h>
+#include <llvm/MC/MCAsmInfo.h>
+#include <llvm/MC/MCCodeEmitter.h>
+#include <llvm/MC/MCContext.h>
+#include <llvm/MC/MCInstrInfo.h>
+#include <llvm/MC/MCObjectFileInfo.h>
+#include <llvm/MC/MCParser/MCAsmParser.h>
+#include <llvm/MC/MCRegisterInfo.h>
+#include <llvm/MC/MCStreamer.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/MC/MCTargetAsmParser.h>
+#include <llvm/MC/MCTargetOptions.h>
 #include <llvm/IR/Module.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/Dwarf.h>
+#include <llvm/Linker/Linker.h>
 #include "../opt/Passes.h"
+#include "../opt/IRCache.h"
+#include "../opt/FunctionModule.h"
+#include "../opt/MemReport.h"
+#include "../opt/Printf.h"
+#include "../opt/Profile.h"
+#include "../opt/Trace.h"
 #pragma clang diagnostic pop
 
 using namespace uscc::parse;
 using namespace llvm;
 
-extern size_t NUM_COLORS;
-
-CodeContext::CodeContext(StringTable& strings)
+CodeContext::CodeContext()
 : mGlobal(getGlobalContext())
-, mModule(nullptr)
+, mModule(new Module("main", mGlobal))
 , mBlock(nullptr)
-, mStrings(strings)
-, mPrintfIdent(nullptr)
-, mZero(nullptr)
+, mZero(Constant::getNullValue(IntegerType::getInt32Ty(mGlobal)))
 , mFunc(nullptr)
+, mCache(nullptr)
+, mStats(nullptr)
+, mInstrument(false)
+, mNextFuncId(0)
+, mDIFile(nullptr)
+, mDIFunc(nullptr)
+{
+	
+}
+
+// Returns the declaration for stdlib "printf", adding it on first use
+Function* CodeContext::getPrintf() noexcept
+{
+	Function* func = mModule->getFunction("printf");
+	if (func == nullptr)
+	{
+		std::vector<llvm::Type*> printfArgs;
+		printfArgs.push_back(llvm::Type::getInt8PtrTy(mGlobal));
+		
+		FunctionType* printfType = FunctionType::get(llvm::Type::getInt32Ty(mGlobal),
+													 printfArgs, true);
+		
+		func = Function::Create(printfType, GlobalValue::LinkageTypes::ExternalLinkage,
+								"printf", mModule);
+		func->setCallingConv(CallingConv::C);
+	}
+	
+	return func;
+}
+
+Function* CodeContext::getEnterHook() noexcept
 {
+	Function* func = mModule->getFunction("__uscc_func_enter");
+	if (func == nullptr)
+	{
+		// void __uscc_func_enter(int id, char* name)
+		std::vector<llvm::Type*> hookArgs;
+		hookArgs.push_back(llvm::Type::getInt32Ty(mGlobal));
+		hookArgs.push_back(llvm::Type::getInt8PtrTy(mGlobal));
+		
+		FunctionType* hookType = FunctionType::get(llvm::Type::getVoidTy(mGlobal),
+												   hookArgs, false);
+		
+		func = Function::Create(hookType, GlobalValue::LinkageTypes::ExternalLinkage,
+								"__uscc_func_enter", mModule);
+		func->setCallingConv(CallingConv::C);
+	}
 	
+	return func;
 }
 
-Emitter::Emitter(Parser& parser) noexcept
-: mContext(parser.mStrings)
+Function* CodeContext::getExitHook() noexcept
 {
-	if (parser.mNeedPrintf)
+	Function* func = mModule->getFunction("__uscc_func_exit");
+	if (func == nullptr)
 	{
-		mContext.mPrintfIdent = parser.mSymbols.getIdentifier("printf");
+		// void __uscc_func_exit(int id)
+		FunctionType* hookType = FunctionType::get(llvm::Type::getVoidTy(mGlobal),
+												   llvm::Type::getInt32Ty(mGlobal), false);
+		
+		func = Function::Create(hookType, GlobalValue::LinkageTypes::ExternalLinkage,
+								"__uscc_func_exit", mModule);
+		func->setCallingConv(CallingConv::C);
 	}
 	
-	// Initialize zero
-	mContext.mZero = Constant::getNullValue(IntegerType::getInt32Ty(mContext.mGlobal));
+	return func;
+}
+
+// Out of line, since DIBuilder is only declared in Emitter.h
+CodeContext::~CodeContext()
+{
+	
+}
+
+void CodeContext::initDebugInfo(const char* fileName) noexcept
+{
+	SmallString<128> path(fileName);
+	sys::fs::make_absolute(path);
+	StringRef dir = sys::path::parent_path(path);
+	StringRef name = sys::path::filename(path);
+	
+	// Only line tables are needed for profilers to map code to lines
+	mDIBuilder.reset(new DIBuilder(*mModule));
+	mDIBuilder->createCompileUnit(dwarf::DW_LANG_C99, name, dir, "uscc", false, "", 0,
+								  "", DIBuilder::LineTablesOnly);
+	mDIFile = mDIBuilder->createFile(name, dir);
+	
+	// Without this, debug info is dropped when the module is read back in
+	mModule->addModuleFlag(Module::Warning, "Debug Info Version", DEBUG_METADATA_VERSION);
+}
+
+void CodeContext::beginDebugFunction(unsigned line) noexcept
+{
+	DIFile file(mDIFile);
+	DICompositeType type = mDIBuilder->createSubroutineType(file,
+		mDIBuilder->getOrCreateArray(ArrayRef<Value*>()));
+	mDIFunc = mDIBuilder->createFunction(file, mFunc->getName(), mFunc->getName(), file,
+										 line, type, false, true, line, 0, false, mFunc);
+}
+
+CodeContext::DebugMark CodeContext::markDebugLoc() const noexcept
+{
+	DebugMark mark;
+	mark.mBlock = mBlock;
+	mark.mLast = nullptr;
+	// Phis can be removed by the SSA builder later on, so they can't be marks.
+	// (If the last instruction is a phi, they all are.)
+	if (mBlock && !mBlock->empty() && !isa<PHINode>(mBlock->back()))
+	{
+		mark.mLast = &mBlock->back();
+	}
+	return mark;
+}
+
+void CodeContext::setDebugLoc(const DebugMark& mark, SourceLoc loc) noexcept
+{
+	if (!mDIFunc || !mark.mBlock)
+	{
+		return;
+	}
+	
+	// New blocks are added at the end of the function, so everything
+	// emitted since mark is after it
+	DebugLoc debugLoc = DebugLoc::get(loc.getLine(), loc.getCol(), mDIFunc);
+	Function::iterator bb = mark.mBlock;
+	BasicBlock::iterator inst = mark.mLast ? ++BasicBlock::iterator(mark.mLast) : bb->begin();
+	while (true)
+	{
+		for (; inst != bb->end(); ++inst)
+		{
+			if (inst->getDebugLoc().isUnknown() && !isa<PHINode>(inst))
+			{
+				inst->setDebugLoc(debugLoc);
+			}
+		}
+		if (++bb == mFunc->end())
+		{
+			break;
+		}
+		inst = bb->begin();
+	}
+}
+
+static TargetMachine* createHostTargetMachine();
+
+// Returns the options to optimize with (the defaults if options is null).
+// From -O2 up, the LLVM passes need a target; if options doesn't have
+// one, a host target machine is created and stored in target.
+static uscc::opt::OptOptions getOptOptions(const uscc::opt::OptOptions* options,
+										   std::unique_ptr<TargetMachine>& target)
+{
+	uscc::opt::OptOptions result;
+	if (options)
+	{
+		result = *options;
+	}
+	if (result.mLevel >= 2 && !result.mTarget)
+	{
+		target.reset(createHostTargetMachine());
+		result.mTarget = target.get();
+	}
+	return result;
+}
+
+// Writes the register allocation statistics as JSON to fileName
+static bool saveRegAllocStats(const char* fileName,
+							  const std::vector<uscc::opt::RegAllocStats>& raStats)
+{
+	std::string statsErr;
+	raw_fd_ostream statsOut(fileName, statsErr, sys::fs::F_Text);
+	if (!statsErr.empty())
+	{
+		errs() << fileName << ": " << statsErr << "\n";
+		return false;
+	}
+	uscc::opt::writeRegAllocStats(raStats, statsOut);
+	return true;
+}
+
+// State for streaming machine code output (see Emitter::streamAsm)
+struct Emitter::StreamState
+{
+	std::unique_ptr<TargetMachine> mTarget;
+	std::unique_ptr<tool_output_file> mOut;
+	std::unique_ptr<formatted_raw_ostream> mFOS;
+	std::unique_ptr<legacy::FunctionPassManager> mPasses;
+	std::vector<uscc::opt::RegAllocStats> mRAStats;
+	std::string mRAStatsFile;
+};
+
+Emitter::Emitter(Parser& parser, opt::IRCache* cache,
+				 std::vector<opt::OptStats>* stats, bool instrument,
+				 bool debugInfo) noexcept
+: mValid(true)
+{
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::IR);
+	mContext.mCache = cache;
+	mContext.mStats = stats;
+	mContext.mInstrument = instrument;
+	if (debugInfo)
+	{
+		mContext.initDebugInfo(parser.mFileName);
+	}
 	
 	// This is what kicks off the generation of the LLVM IR from the AST
 	parser.mRoot->emitIR(mContext);
+	
+	if (mContext.mDIBuilder)
+	{
+		mContext.mDIBuilder->finalize();
+	}
+}
+
+Emitter::Emitter(bool optimize, opt::IRCache* cache, const opt::OptOptions* options) noexcept
+: mValid(true)
+{
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::IR);
+	mContext.mCache = cache;
+	mContext.mStats = options ? options->mStats : nullptr;
+	
+	if (optimize)
+	{
+		mOptPasses.reset(new legacy::FunctionPassManager(mContext.mModule));
+		uscc::opt::registerOptPasses(*mOptPasses, getOptOptions(options, mOptTarget));
+		mOptPasses->doInitialization();
+	}
+}
+
+Emitter::~Emitter()
+{
+	// The pass managers refer to the module, so go first
+	mStream.reset();
+	mOptPasses.reset();
+	mOptTarget.reset();
+	delete mContext.mModule;
+}
+
+// Streaming: emit, verify and optimize one function, then (if streaming
+// machine code) compile it and throw away its IR
+void Emitter::functionParsed(std::shared_ptr<ASTFunction> func) noexcept
+{
+	if (!mValid)
+	{
+		return;
+	}
+	
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::IR);
+	Function* f = static_cast<Function*>(func->emitIR(mContext));
+	if (verifyFunction(*f, &errs()))
+	{
+		mValid = false;
+		return;
+	}
+	
+	if (mContext.mCachedFuncs.count(f) == 0)
+	{
+		if (mOptPasses)
+		{
+			mOptPasses->run(*f);
+		}
+		updateCache();
+	}
+	
+	if (mStream)
+	{
+		uscc::opt::MemScope codegenScope(uscc::opt::MemTag::Codegen);
+		mStream->mPasses->run(*f);
+		f->deleteBody();
+	}
+}
+
+bool Emitter::finish() noexcept
+{
+	if (mOptPasses)
+	{
+		mOptPasses->doFinalization();
+		mOptPasses.reset();
+		mOptTarget.reset();
+	}
+	
+	if (!mValid)
+	{
+		return false;
+	}
+	
+	// The printf pass only declares the helpers it calls
+	uscc::opt::definePrintHelpers(*mContext.mModule);
+	
+	if (mStream)
+	{
+		// Every streamed function's body was thrown away, so
+		// anything still defined is a helper added just now
+		uscc::opt::MemScope codegenScope(uscc::opt::MemTag::Codegen);
+		for (auto& f : *mContext.mModule)
+		{
+			if (!f.isDeclaration())
+			{
+				mStream->mPasses->run(f);
+			}
+		}
+		mStream->mPasses->doFinalization();
+		mStream->mPasses.reset();
+		mStream->mFOS.reset();
+		
+		if (!mStream->mRAStatsFile.empty() &&
+			!saveRegAllocStats(mStream->mRAStatsFile.c_str(), mStream->mRAStats))
+		{
+			return false;
+		}
+		
+		mStream->mOut->keep();
+		mStream.reset();
+	}
+	
+	return true;
+}
+
+void Emitter::optimize(unsigned jobs, const opt::OptOptions* options) noexcept
+{
+	uscc::opt::TraceSpan span("optimize");
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::IR);
+	// The target is shared by the worker threads, which only read it
+	std::unique_ptr<TargetMachine> target;
+	uscc::opt::OptOptions optOptions = getOptOptions(options, target);
+	
+	if (jobs > 1)
+	{
+		optimizeParallel(jobs, optOptions);
+	}
+	else
+	{
+		// Functions loaded from the cache have already been optimized
+		legacy::FunctionPassManager fpm(mContext.mModule);
+		uscc::opt::registerOptPasses(fpm, optOptions);
+		fpm.doInitialization();
+		for (auto& f : *mContext.mModule)
+		{
+			if (!f.isDeclaration() && mContext.mCachedFuncs.count(&f) == 0)
+			{
+				fpm.run(f);
+			}
+		}
+		fpm.doFinalization();
+	}
+	
+	// The printf pass only declares the helpers it calls
+	uscc::opt::definePrintHelpers(*mContext.mModule);
 }
 
-void Emitter::optimize() noexcept
+void Emitter::optimizeInterproc(const opt::OptOptions* options) noexcept
 {
+	std::unique_ptr<TargetMachine> target;
+	uscc::opt::OptOptions optOptions = getOptOptions(options, target);
+	if (optOptions.mLevel < 3)
+	{
+		return;
+	}
+	
+	uscc::opt::TraceSpan span("interprocedural passes");
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::IR);
 	legacy::PassManager pm;
-	uscc::opt::registerOptPasses(pm);
+	uscc::opt::registerInterprocPasses(pm, optOptions);
 	pm.run(*mContext.mModule);
 }
 
+// Every uscc pass is function-local, so each function can be optimized
+// on its own. LLVMContexts aren't thread safe, so each function is moved
+// to a private context (via bitcode) for the worker thread, and the results
+// are spliced back in on this thread, in order. (An interprocedural pass
+// would have to run here, after all the workers are done.)
+void Emitter::optimizeParallel(unsigned jobs, const opt::OptOptions& options) noexcept
+{
+	std::vector<Function*> funcs;
+	for (auto& f : *mContext.mModule)
+	{
+		if (!f.isDeclaration() && mContext.mCachedFuncs.count(&f) == 0)
+		{
+			funcs.push_back(&f);
+		}
+	}
+	
+	std::vector<std::string> names(funcs.size());
+	std::vector<std::string> work(funcs.size());
+	for (size_t i = 0; i < funcs.size(); i++)
+	{
+		names[i] = funcs[i]->getName().str();
+		work[i] = uscc::opt::extractFunction(funcs[i]);
+	}
+	
+	uscc::opt::initializeOptPasses();
+	
+	// Each function collects its statistics on its own, and they're
+	// added to options.mStats in order afterwards
+	std::vector<std::vector<uscc::opt::OptStats>> stats(funcs.size());
+	
+	std::atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		uscc::opt::MemScope memScope(uscc::opt::MemTag::IR);
+		size_t i;
+		while ((i = next++) < work.size())
+		{
+			uscc::opt::OptOptions funcOptions = options;
+			if (options.mStats)
+			{
+				funcOptions.mStats = &stats[i];
+			}
+			work[i] = uscc::opt::optimizeIsolated(work[i], names[i], funcOptions);
+		}
+	};
+	
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < jobs && t < funcs.size(); t++)
+	{
+		threads.push_back(std::thread(worker));
+	}
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+	
+	for (size_t i = 0; i < funcs.size(); i++)
+	{
+		// If something went wrong, the function just stays unoptimized
+		// (and what the passes did to the copy isn't counted)
+		bool spliced = !work[i].empty() && uscc::opt::spliceFunction(work[i], funcs[i]);
+		
+		if (spliced && options.mStats)
+		{
+			for (auto& s : stats[i])
+			{
+				for (auto& pass : s.mCounts)
+				{
+					for (auto& counter : pass.second)
+					{
+						uscc::opt::countStat(*options.mStats, s.mFunction,
+											 pass.first.c_str(), counter.first.c_str(),
+											 counter.second);
+					}
+				}
+			}
+		}
+	}
+}
+
+void Emitter::updateCache() noexcept
+{
+	if (mContext.mCache)
+	{
+		for (auto& p : mContext.mEmittedFuncs)
+		{
+			mContext.mCache->store(p.second, p.first);
+		}
+	}
+	mContext.mEmittedFuncs.clear();
+}
+
+void Emitter::instrumentProfile(const char* fileName) noexcept
+{
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::IR);
+	uscc::opt::instrumentProfile(*mContext.mModule, fileName);
+}
+
+bool Emitter::useProfile(const char* fileName) noexcept
+{
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::IR);
+	std::string error;
+	if (!uscc::opt::useProfile(*mContext.mModule, fileName, error))
+	{
+		errs() << fileName << ": " << error << "\n";
+		return false;
+	}
+	return true;
+}
+
+void Emitter::bufferOutput() noexcept
+{
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::IR);
+	uscc::opt::lowerPrintfToRuntime(*mContext.mModule);
+}
+
+// Only used for its address, to find the uscc executable
+static void findRuntimeAnchor() { }
+
+bool Emitter::linkRuntime(const char* argv0) noexcept
+{
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::IR);
+	std::string exePath = sys::fs::getMainExecutable(argv0,
+		reinterpret_cast<void*>(&findRuntimeAnchor));
+	SmallString<128> rtPath(sys::path::parent_path(exePath));
+	sys::path::append(rtPath, "uscc_rt.bc");
+	
+	SMDiagnostic diag;
+	Module* runtime = ParseIRFile(rtPath.str().str(), diag, mContext.mGlobal);
+	if (!runtime)
+	{
+		diag.print("uscc", errs());
+		return false;
+	}
+	
+	std::string error;
+	bool failed = Linker::LinkModules(mContext.mModule, runtime, Linker::DestroySource, &error);
+	delete runtime;
+	if (failed)
+	{
+		errs() << rtPath << ": " << error << "\n";
+		return false;
+	}
+	return true;
+}
+
 void Emitter::print() noexcept
 {
 	legacy::PassManager pm;
@@ -116,28 +631,112 @@ bool Emitter::verify() noexcept
 }
 
 // This function will take the bitcode emitted by uscc and convert it to assembly
-bool Emitter::writeAsm(const char *fileName, unsigned long numColors) noexcept
+bool Emitter::writeAsm(const char *fileName, unsigned long numColors,
+					   const char* raStatsFile) noexcept
 {
-	NUM_COLORS = static_cast<size_t>(numColors);
-	Module* mod = mContext.mModule;
-	// This code is copied over from llc
-	InitializeNativeTarget();
-	InitializeNativeTargetAsmPrinter();
-	InitializeNativeTargetAsmParser();
-	
-	PassRegistry *Registry = PassRegistry::getPassRegistry();
-	initializeCore(*Registry);
-	initializeCodeGen(*Registry);
-	initializeLoopStrengthReducePass(*Registry);
-	initializeLowerIntrinsicsPass(*Registry);
-	initializeUnreachableBlockElimPass(*Registry);
-	
-	const char* argv[] = {
-		fileName,
-		"-optimize-regalloc=true",
-		"-regalloc=uscc"
-	};
-	cl::ParseCommandLineOptions(3, argv, "llvm system compiler\n");
+	return writeMachineCode(fileName, false, numColors, raStatsFile);
+}
+
+// Like writeAsm, but the target's integrated assembler writes an object file
+bool Emitter::writeObject(const char *fileName, unsigned long numColors,
+						  const char* raStatsFile) noexcept
+{
+	return writeMachineCode(fileName, true, numColors, raStatsFile);
+}
+
+void Emitter::emitBitcode(std::string& out) noexcept
+{
+	raw_string_ostream stream(out);
+	legacy::PassManager pm;
+	pm.add(createBitcodeWriterPass(stream));
+	pm.run(*mContext.mModule);
+	stream.flush();
+}
+
+bool Emitter::emitAsm(std::string& out, unsigned long numColors) noexcept
+{
+	raw_string_ostream stream(out);
+	bool retVal = emitMachineCode(stream, false, numColors, nullptr);
+	stream.flush();
+	return retVal;
+}
+
+bool Emitter::emitObject(std::string& out, unsigned long numColors) noexcept
+{
+	raw_string_ostream stream(out);
+	bool retVal = emitMachineCode(stream, true, numColors, nullptr);
+	stream.flush();
+	return retVal;
+}
+
+// Opens the output file for writeAsm/writeObject, and writes the
+// register allocation statistics if they were requested
+bool Emitter::writeMachineCode(const char *fileName, bool isObject,
+							   unsigned long numColors, const char* raStatsFile) noexcept
+{
+	std::string Error;
+	sys::fs::OpenFlags OpenFlags = sys::fs::F_None;
+	if (!isObject)
+	{
+		OpenFlags |= sys::fs::F_Text;
+	}
+	std::unique_ptr<tool_output_file> Out(new tool_output_file(fileName, Error,
+															   OpenFlags));
+	if (!Error.empty())
+	{
+		errs() << fileName << ": " << Error << "\n";
+		return false;
+	}
+	
+	std::vector<uscc::opt::RegAllocStats> raStats;
+	if (!emitMachineCode(Out->os(), isObject, numColors,
+						 raStatsFile ? &raStats : nullptr))
+	{
+		return false;
+	}
+	
+	if (raStatsFile && !saveRegAllocStats(raStatsFile, raStats))
+	{
+		return false;
+	}
+	
+	// Declare success.
+	Out->keep();
+	
+	return true;
+}
+
+// The target and pass registries are global, so they're set up once,
+// on the first code generation request (from whichever thread makes it)
+static std::once_flag codeGenInitFlag;
+
+static void initCodeGen()
+{
+	std::call_once(codeGenInitFlag, []
+	{
+		// This code is copied over from llc
+		InitializeNativeTarget();
+		InitializeNativeTargetAsmPrinter();
+		InitializeNativeTargetAsmParser();
+		
+		PassRegistry *Registry = PassRegistry::getPassRegistry();
+		initializeCore(*Registry);
+		initializeCodeGen(*Registry);
+		initializeLoopStrengthReducePass(*Registry);
+		initializeLowerIntrinsicsPass(*Registry);
+		initializeUnreachableBlockElimPass(*Registry);
+		
+		// Set directly, rather than by parsing -regalloc=uscc into LLVM's
+		// process wide options. (-optimize-regalloc is already on at
+		// every level but CodeGenOpt::None, which isn't used here.)
+		uscc::opt::useUSCCRegisterAllocator();
+	});
+}
+
+// Creates the target machine for the host
+static TargetMachine* createHostTargetMachine()
+{
+	initCodeGen();
 	
 	Triple TheTriple;
 	TheTriple.setTriple(sys::getDefaultTargetTriple());
@@ -149,8 +748,8 @@ bool Emitter::writeAsm(const char *fileName, unsigned long numColors) noexcept
 	const Target *TheTarget = TargetRegistry::lookupTarget("", TheTriple,
 														   Error);
 	if (!TheTarget) {
-		errs() << fileName << ": " << Error;
-		return false;
+		errs() << "uscc: " << Error;
+		return nullptr;
 	}
 	
 	// Package up features to be passed to target/subtarget
@@ -162,55 +761,414 @@ bool Emitter::writeAsm(const char *fileName, unsigned long numColors) noexcept
 	Options.MCOptions.MCUseDwarfDirectory = false;
 	Options.MCOptions.AsmVerbose = true;
 	
-	std::unique_ptr<TargetMachine> target(
-										  TheTarget->createTargetMachine(TheTriple.getTriple(), MCPU, "",
-																		 Options, Reloc::Default,
-																		 CodeModel::Default, OLvl));
-	assert(target.get() && "Could not allocate target machine!");
+	TargetMachine* target = TheTarget->createTargetMachine(TheTriple.getTriple(), MCPU, "",
+														   Options, Reloc::Default,
+														   CodeModel::Default, OLvl);
+	assert(target && "Could not allocate target machine!");
+	return target;
+}
+
+// Adds the passes to compile mod to machine code on out.
+// Works with a module PassManager, or a FunctionPassManager
+// to compile one function at a time.
+static bool addCodeGenPasses(legacy::PassManagerBase& PM, TargetMachine& Target,
+							 Module* mod, formatted_raw_ostream& out, bool isObject,
+							 unsigned long numColors,
+							 std::vector<uscc::opt::RegAllocStats>* raStats)
+{
+	// Add an appropriate TargetLibraryInfo pass for the module's triple.
+	TargetLibraryInfo *TLI = new TargetLibraryInfo(Triple(Target.getTargetTriple()));
+	PM.add(TLI);
 	
+	// Let the USCC register allocator know about the color cap,
+	// and where to put its statistics (if they were requested)
+	PM.add(new uscc::opt::RegAllocConfig(static_cast<unsigned>(numColors), raStats));
+		
+	// Add the target data from the target machine, if it exists, or the module.
+	if (const DataLayout *DL = Target.getDataLayout())
+		mod->setDataLayout(DL);
 	
-	assert(mod && "Should have exited if we didn't have a module!");
-	TargetMachine &Target = *target.get();
+	PM.add(new DataLayoutPass(mod));
 	
+	TargetMachine::CodeGenFileType FileType = isObject ?
+		TargetMachine::CGFT_ObjectFile : TargetMachine::CGFT_AssemblyFile;
 	
-	sys::fs::OpenFlags OpenFlags = sys::fs::F_None;
-	OpenFlags |= sys::fs::F_Text;
-	tool_output_file *FDOut = new tool_output_file(fileName, Error,
-												   OpenFlags);
-	// Figure out where we are going to send the output.
-	std::unique_ptr<tool_output_file> Out(FDOut);
-	if (!Out) return 1;
+	// Ask the target to add backend passes as necessary.
+	if (Target.addPassesToEmitFile(PM, out, FileType, false,
+								   nullptr, nullptr)) {
+		errs() << "uscc: target does not support generation of this"
+		<< " file type!\n";
+		return false;
+	}
+	
+	return true;
+}
+
+// Shared code generation for assembly/object output, to any stream
+bool Emitter::emitMachineCode(raw_ostream& out, bool isObject, unsigned long numColors,
+							  std::vector<uscc::opt::RegAllocStats>* raStats) noexcept
+{
+	Module* mod = mContext.mModule;
+	assert(mod && "Should have exited if we didn't have a module!");
+	uscc::opt::TraceSpan span("codegen");
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::Codegen);
+	
+	std::unique_ptr<TargetMachine> target(createHostTargetMachine());
+	if (!target)
+	{
+		return false;
+	}
 	
 	// Build up all of the passes that we want to do to the module.
 	PassManager PM;
 	
-	// Add an appropriate TargetLibraryInfo pass for the module's triple.
-	TargetLibraryInfo *TLI = new TargetLibraryInfo(TheTriple);
-	PM.add(TLI);
+	{
+		formatted_raw_ostream FOS(out);
 		
-	// Add the target data from the target machine, if it exists, or the module.
-	if (const DataLayout *DL = Target.getDataLayout())
-		mod->setDataLayout(DL);
-	
-	PM.add(new DataLayoutPass(mod));
+		if (!addCodeGenPasses(PM, *target, mod, FOS, isObject, numColors, raStats))
+		{
+			return false;
+		}
 		
+		PM.run(*mod);
+	}
+	
+	return true;
+}
+
+// This is the same setup llvm-mc uses to assemble a file
+bool Emitter::assembleObject(const char* asmFile, const char* objFile) noexcept
+{
+	uscc::opt::TraceSpan span("assemble");
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::Codegen);
+	
+	// Only used for the triple, CPU and features codegen used
+	std::unique_ptr<TargetMachine> target(createHostTargetMachine());
+	if (!target)
 	{
-		formatted_raw_ostream FOS(Out->os());
-		
+		return false;
+	}
+	const Target& T = target->getTarget();
+	StringRef triple = target->getTargetTriple();
+	
+	ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(asmFile);
+	if (!buffer)
+	{
+		errs() << asmFile << ": " << buffer.getError().message() << "\n";
+		return false;
+	}
+	SourceMgr SrcMgr;
+	SrcMgr.AddNewSourceBuffer(buffer.get().release(), SMLoc());
+	
+	std::string Error;
+	std::unique_ptr<tool_output_file> Out(new tool_output_file(objFile, Error,
+															   sys::fs::F_None));
+	if (!Error.empty())
+	{
+		errs() << objFile << ": " << Error << "\n";
+		return false;
+	}
+	
+	std::unique_ptr<MCRegisterInfo> MRI(T.createMCRegInfo(triple));
+	std::unique_ptr<MCAsmInfo> MAI(T.createMCAsmInfo(*MRI, triple));
+	std::unique_ptr<MCInstrInfo> MCII(T.createMCInstrInfo());
+	std::unique_ptr<MCSubtargetInfo> STI(T.createMCSubtargetInfo(triple,
+		target->getTargetCPU(), target->getTargetFeatureString()));
+	MCObjectFileInfo MOFI;
+	MCContext Ctx(MAI.get(), MRI.get(), &MOFI, &SrcMgr);
+	MOFI.InitMCObjectFileInfo(triple, Reloc::Default, CodeModel::Default, Ctx);
+	
+	// The streamer owns the code emitter and backend
+	MCCodeEmitter* CE = T.createMCCodeEmitter(*MCII, *MRI, *STI, Ctx);
+	MCAsmBackend* MAB = T.createMCAsmBackend(*MRI, triple, target->getTargetCPU());
+	if (!CE || !MAB)
+	{
+		errs() << "uscc: target does not support generation of this"
+		<< " file type!\n";
+		return false;
+	}
+	std::unique_ptr<MCStreamer> Str(T.createMCObjectStreamer(triple, Ctx, *MAB, Out->os(), CE,
+															 *STI, false, false));
+	
+	std::unique_ptr<MCAsmParser> Parser(createMCAsmParser(SrcMgr, Ctx, *Str, *MAI));
+	std::unique_ptr<MCTargetAsmParser> TAP(T.createMCAsmParser(*STI, *Parser, *MCII,
+															   MCTargetOptions()));
+	if (!TAP)
+	{
+		return false;
+	}
+	Parser->setTargetParser(*TAP);
+	
+	// Run writes the object file at the end, unless there were errors
+	if (Parser->Run(false))
+	{
+		return false;
+	}
+	
+	Out->keep();
+	return true;
+}
+
+// Compiles a module made by extractFunction to assembly, with its own
+// LLVMContext and TargetMachine so it can run on any thread
+static bool compileIsolated(const std::string& bitcode, unsigned long numColors,
+							std::vector<uscc::opt::RegAllocStats>* raStats,
+							std::string& asmOut)
+{
+	uscc::opt::TraceSpan span("codegen");
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::Codegen);
+	LLVMContext ctx;
+	std::unique_ptr<MemoryBuffer> buffer(MemoryBuffer::getMemBuffer(bitcode, "", false));
+	ErrorOr<Module*> result = parseBitcodeFile(buffer.get(), ctx);
+	if (!result)
+	{
+		return false;
+	}
+	std::unique_ptr<Module> mod(result.get());
+	
+	std::unique_ptr<TargetMachine> target(createHostTargetMachine());
+	if (!target)
+	{
+		return false;
+	}
+	
+	raw_string_ostream out(asmOut);
+	PassManager PM;
+	
+	{
+		formatted_raw_ostream FOS(out);
 		
-		// Ask the target to add backend passes as necessary.
-		if (Target.addPassesToEmitFile(PM, FOS, TargetMachine::CGFT_AssemblyFile, false,
-									   nullptr, nullptr)) {
-			errs() << fileName << ": target does not support generation of this"
-			<< " file type!\n";
-			return 1;
+		if (!addCodeGenPasses(PM, *target, mod.get(), FOS, false, numColors, raStats))
+		{
+			return false;
 		}
 		
 		PM.run(*mod);
 	}
 	
+	out.flush();
+	return true;
+}
+
+static bool isLabelChar(char c)
+{
+	return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == '$';
+}
+
+// Every partition numbers its assembler-local labels (.LBB0_1, .Ltmp0,
+// .L.str...) from zero, so give each partition its own prefix before the
+// partitions are put in the same file. Quoted strings are left alone.
+static std::string renameLocalLabels(const std::string& text, size_t partition)
+{
+	std::string prefix = ".Lp" + std::to_string(partition) + "_";
+	std::string result;
+	result.reserve(text.size() + text.size() / 8);
+	
+	bool inQuote = false;
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		char c = text[i];
+		if (inQuote)
+		{
+			result += c;
+			if (c == '\\' && i + 1 < text.size())
+			{
+				result += text[++i];
+			}
+			else if (c == '"' || c == '\n')
+			{
+				inQuote = false;
+			}
+			continue;
+		}
+		
+		if (c == '"')
+		{
+			inQuote = true;
+		}
+		else if (c == '.' && i + 1 < text.size() && text[i + 1] == 'L' &&
+				 (i == 0 || !isLabelChar(text[i - 1])))
+		{
+			result += prefix;
+			i++;
+			continue;
+		}
+		result += c;
+	}
+	
+	return result;
+}
+
+// Code generation is done per function, the same way optimizeParallel
+// splits up optimization: each function (with copies of the strings it
+// uses) is moved to a private context, so the code generator and
+// register allocator can run on several threads at once. The partitions
+// are always split and put back together the same way, so the number of
+// threads doesn't change the output.
+bool Emitter::writeAsmSplit(const char* fileName, unsigned jobs, unsigned long numColors,
+							const char* raStatsFile) noexcept
+{
+	if (jobs == 0)
+	{
+		jobs = 1;
+	}
+	
+	std::vector<std::string> work;
+	for (auto& f : *mContext.mModule)
+	{
+		if (!f.isDeclaration())
+		{
+			work.push_back(uscc::opt::extractFunction(&f));
+		}
+	}
+	
+	// Sets up the targets and command line options, which isn't thread safe
+	initCodeGen();
+	
+	std::vector<std::string> asmOut(work.size());
+	std::vector<std::vector<uscc::opt::RegAllocStats>> raStats(work.size());
+	std::vector<char> succeeded(work.size(), 0);
+	
+	std::atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		size_t i;
+		while ((i = next++) < work.size())
+		{
+			succeeded[i] = compileIsolated(work[i], numColors,
+										   raStatsFile ? &raStats[i] : nullptr,
+										   asmOut[i]);
+		}
+	};
+	
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < jobs && t < work.size(); t++)
+	{
+		threads.push_back(std::thread(worker));
+	}
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+	
+	std::string Error;
+	std::unique_ptr<tool_output_file> Out(new tool_output_file(fileName, Error,
+															   sys::fs::F_None | sys::fs::F_Text));
+	if (!Error.empty())
+	{
+		errs() << fileName << ": " << Error << "\n";
+		return false;
+	}
+	
+	std::vector<uscc::opt::RegAllocStats> allStats;
+	for (size_t i = 0; i < work.size(); i++)
+	{
+		if (!succeeded[i])
+		{
+			return false;
+		}
+		Out->os() << renameLocalLabels(asmOut[i], i);
+		allStats.insert(allStats.end(), raStats[i].begin(), raStats[i].end());
+	}
+	
+	if (raStatsFile && !saveRegAllocStats(raStatsFile, allStats))
+	{
+		return false;
+	}
+	
 	// Declare success.
 	Out->keep();
+	
+	return true;
+}
+
+// Streaming: sets up codegen so each function is compiled
+// to assembly as soon as it's emitted
+bool Emitter::streamAsm(const char* fileName, unsigned long numColors,
+						const char* raStatsFile) noexcept
+{
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::Codegen);
+	std::unique_ptr<StreamState> stream(new StreamState);
+	stream->mTarget.reset(createHostTargetMachine());
+	if (!stream->mTarget)
+	{
+		return false;
+	}
+	
+	std::string Error;
+	stream->mOut.reset(new tool_output_file(fileName, Error,
+											sys::fs::F_None | sys::fs::F_Text));
+	if (!Error.empty())
+	{
+		errs() << fileName << ": " << Error << "\n";
+		return false;
+	}
+	stream->mFOS.reset(new formatted_raw_ostream(stream->mOut->os()));
+	
+	if (raStatsFile)
+	{
+		stream->mRAStatsFile = raStatsFile;
+	}
+	
+	stream->mPasses.reset(new legacy::FunctionPassManager(mContext.mModule));
+	if (!addCodeGenPasses(*stream->mPasses, *stream->mTarget, mContext.mModule,
+						  *stream->mFOS, false, numColors,
+						  raStatsFile ? &stream->mRAStats : nullptr))
+	{
+		return false;
+	}
+	
+	// This writes out the start of the assembly file
+	stream->mPasses->doInitialization();
+	
+	mStream = std::move(stream);
+	return true;
+}
 
+// JIT compile the module with MCJIT and call main, similar to lli
+bool Emitter::run(const char* progName, int& exitCode) noexcept
+{
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::Codegen);
+	Module* mod = mContext.mModule;
+	initCodeGen();
+	
+	Function* mainFunc = mod->getFunction("main");
+	if (!mainFunc)
+	{
+		errs() << progName << ": no main function to run\n";
+		return false;
+	}
+	
+	std::string Error;
+	EngineBuilder builder(mod);
+	builder.setErrorStr(&Error);
+	builder.setEngineKind(EngineKind::JIT);
+	builder.setUseMCJIT(true);
+	builder.setMCJITMemoryManager(new SectionMemoryManager());
+	builder.setOptLevel(CodeGenOpt::Less);
+	
+	// The engine takes ownership of the module
+	std::unique_ptr<ExecutionEngine> engine(builder.create());
+	if (!engine)
+	{
+		errs() << progName << ": unable to create JIT: " << Error << "\n";
+		return false;
+	}
+	
+	engine->finalizeObject();
+	
+	std::vector<std::string> args;
+	args.push_back(progName);
+	// Destructors are how a --profile-generate build writes its counts
+	engine->runStaticConstructorsDestructors(false);
+	exitCode = engine->runFunctionAsMain(mainFunc, args, nullptr);
+	engine->runStaticConstructorsDestructors(true);
+	
+	// The JIT'd code writes through the same C stdio buffers as uscc
+	fflush(stdout);
+	
+	// Take the module back so it outlives the engine
+	engine->removeModule(mod);
+	
 	return true;
 }
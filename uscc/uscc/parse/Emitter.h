@@ -21,10 +21,38 @@
 #pragma clang diagnostic pop
 
 #include "Types.h"
+#include "ASTNodes.h"
 #include "../opt/SSABuilder.h"
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <utility>
+#include <cstdint>
+
+namespace llvm
+{
+class raw_ostream;
+class Function;
+class Instruction;
+class MDNode;
+class DIBuilder;
+class TargetMachine;
+namespace legacy
+{
+class FunctionPassManager;
+}
+}
 
 namespace uscc
 {
+namespace opt
+{
+struct RegAllocStats;
+struct OptStats;
+struct OptOptions;
+class IRCache;
+}
+
 namespace parse
 {
 
@@ -33,7 +61,31 @@ class Identifier;
 
 struct CodeContext
 {
-	CodeContext(StringTable& strings);
+	CodeContext();
+	~CodeContext();
+	
+	// Returns the declaration of printf, adding it if needed
+	llvm::Function* getPrintf() noexcept;
+	// Returns the declarations of the runtime's function entry/exit
+	// hooks (see --instrument-functions), adding them if needed
+	llvm::Function* getEnterHook() noexcept;
+	llvm::Function* getExitHook() noexcept;
+	
+	// Debug info (-g). Starts the line tables for fileName.
+	void initDebugInfo(const char* fileName) noexcept;
+	// Adds debug info for mFunc, which starts on line
+	void beginDebugFunction(unsigned line) noexcept;
+	// Where a statement starts being emitted
+	struct DebugMark
+	{
+		llvm::BasicBlock* mBlock;
+		// Last instruction in mBlock before the statement (if any)
+		llvm::Instruction* mLast;
+	};
+	DebugMark markDebugLoc() const noexcept;
+	// Gives loc to everything emitted since mark that doesn't have a
+	// location yet. Statements inside the statement set theirs first.
+	void setDebugLoc(const DebugMark& mark, SourceLoc loc) noexcept;
 	
 	// Used for our SSA construction algorithm
 	opt::SSABuilder mSSA;
@@ -47,32 +99,125 @@ struct CodeContext
 	// Current basic block
 	llvm::BasicBlock* mBlock;
 	
-	// String table
-	StringTable& mStrings;
-	
-	// This will be non-null if we need extern printf
-	Identifier* mPrintfIdent;
-	
 	// Points to a constant value of zero
 	llvm::Value* mZero;
 	
 	// stores the current function
 	llvm::Function* mFunc;
+	
+	// IR cache for incremental compilation (null if not in use)
+	opt::IRCache* mCache;
+	// Functions whose bodies were loaded from the cache
+	std::unordered_set<llvm::Function*> mCachedFuncs;
+	// Functions emitted from the AST, and their fingerprints
+	std::vector<std::pair<llvm::Function*, uint64_t>> mEmittedFuncs;
+	// If non-null, emitting each function adds its SSA statistics here
+	std::vector<opt::OptStats>* mStats;
+	// If set, functions call the entry/exit hooks, each with its own ID
+	bool mInstrument;
+	unsigned mNextFuncId;
+	
+	// Null unless generating debug info
+	std::unique_ptr<llvm::DIBuilder> mDIBuilder;
+	// The DIFile for the source, and the DISubprogram for mFunc
+	llvm::MDNode* mDIFile;
+	llvm::MDNode* mDIFunc;
 };
 
 class Parser;
 
-class Emitter
+class Emitter : public FunctionSink
 {
 public:
-	Emitter(Parser& parser) noexcept;
-	void optimize() noexcept;
+	// If cache is set, unchanged functions are loaded from it
+	// rather than emitted. If stats is set, statistics for SSA
+	// construction are added to it. If instrument is set, each function
+	// calls the runtime's entry/exit hooks (see linkRuntime). If debugInfo
+	// is set, line tables are emitted.
+	Emitter(Parser& parser, opt::IRCache* cache = nullptr,
+			std::vector<opt::OptStats>* stats = nullptr,
+			bool instrument = false, bool debugInfo = false) noexcept;
+	// Streaming: pass the Emitter to the Parser as its FunctionSink,
+	// and each function is emitted (and optimized, if requested)
+	// as soon as it's parsed. Call finish once the parse is done.
+	// If options is null, the opt passes use their defaults. Statistics
+	// are collected if options->mStats is set.
+	Emitter(bool optimize, opt::IRCache* cache = nullptr,
+			const opt::OptOptions* options = nullptr) noexcept;
+	~Emitter();
+	virtual void functionParsed(std::shared_ptr<ASTFunction> func) noexcept override;
+	// Streaming: compile each function to assembly once it has been
+	// optimized, then free its IR. Must be called before the parse.
+	bool streamAsm(const char* fileName, unsigned long numColors,
+				   const char* raStatsFile = nullptr) noexcept;
+	// Streaming: completes the output. Returns false if any
+	// function had bad IR.
+	bool finish() noexcept;
+	// With jobs > 1, functions are optimized concurrently on that many threads.
+	// If options is null, the opt passes use their defaults.
+	void optimize(unsigned jobs = 1, const opt::OptOptions* options = nullptr) noexcept;
+	// Runs the passes that work across functions (inlining, at -O3).
+	// What they do depends on other functions, so it isn't cached:
+	// call this after updateCache.
+	void optimizeInterproc(const opt::OptOptions* options = nullptr) noexcept;
+	// Stores the functions that weren't loaded from the cache.
+	// Call this after optimize (if optimizing).
+	void updateCache() noexcept;
+	// Adds profile counters, which the program writes to fileName
+	// when it exits. Call this before optimize.
+	void instrumentProfile(const char* fileName) noexcept;
+	// Adds the counts in fileName (from a program built with
+	// instrumentProfile) as branch weights. Call this before optimize.
+	// Returns false if the profile can't be read.
+	bool useProfile(const char* fileName) noexcept;
+	// Lowers printf calls with constant formats to the runtime's buffered
+	// print routines (see linkRuntime). Call this before optimize.
+	void bufferOutput() noexcept;
+	// Links in the uscc runtime (uscc_rt.bc, next to the uscc executable,
+	// which argv0 is used to find). Call this after optimizing.
+	bool linkRuntime(const char* argv0) noexcept;
 	void print() noexcept;
 	void writeBitcode(const char* fileName) noexcept;
 	bool verify() noexcept;
-	bool writeAsm(const char* fileName, unsigned long numColors) noexcept;
+	// If raStatsFile is set, register allocation statistics
+	// are written to it as JSON
+	bool writeAsm(const char* fileName, unsigned long numColors,
+				  const char* raStatsFile = nullptr) noexcept;
+	bool writeObject(const char* fileName, unsigned long numColors,
+					 const char* raStatsFile = nullptr) noexcept;
+	// Writes an object file by assembling asmFile (from writeAsm or
+	// writeAsmSplit), so asking for both doesn't run codegen twice
+	bool assembleObject(const char* asmFile, const char* objFile) noexcept;
+	// Like writeAsm, but each function is compiled on its own, on up to
+	// jobs threads, and the results are concatenated in order. The output
+	// is the same for any number of threads.
+	bool writeAsmSplit(const char* fileName, unsigned jobs, unsigned long numColors,
+					   const char* raStatsFile = nullptr) noexcept;
+	// In-memory variants of the above, which don't touch the filesystem
+	void emitBitcode(std::string& out) noexcept;
+	bool emitAsm(std::string& out, unsigned long numColors) noexcept;
+	bool emitObject(std::string& out, unsigned long numColors) noexcept;
+	// JIT compiles the module and runs main in-process.
+	// progName is passed to the program as argv[0].
+	// Returns false if the JIT could not be created, otherwise
+	// exitCode is set to the return value of main.
+	bool run(const char* progName, int& exitCode) noexcept;
 private:
+	void optimizeParallel(unsigned jobs, const opt::OptOptions& options) noexcept;
+	bool writeMachineCode(const char* fileName, bool isObject,
+						  unsigned long numColors, const char* raStatsFile) noexcept;
+	bool emitMachineCode(llvm::raw_ostream& out, bool isObject, unsigned long numColors,
+						 std::vector<opt::RegAllocStats>* raStats) noexcept;
+
 	CodeContext mContext;
+	
+	// Used when streaming
+	struct StreamState;
+	std::unique_ptr<StreamState> mStream;
+	std::unique_ptr<llvm::legacy::FunctionPassManager> mOptPasses;
+	// Target for mOptPasses, from -O2 up
+	std::unique_ptr<llvm::TargetMachine> mOptTarget;
+	bool mValid;
 };
 
 } // uscc
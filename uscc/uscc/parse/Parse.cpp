@@ -17,10 +17,13 @@
 #include "Parse.h"
 #include <FlexLexer.h>
 #include "Symbols.h"
+#include "../opt/MemReport.h"
+#include "../opt/Trace.h"
 
 // Used if you want to see each token
 #define DEBUG_PRINT_TOKENS 0
 #include <sstream>
+#include <fstream>
 
 #if DEBUG_PRINT_TOKENS
 #include <iostream>
@@ -31,44 +34,88 @@ using namespace uscc::scan;
 using std::shared_ptr;
 using std::make_shared;
 
+// 64-bit FNV-1a, used for function fingerprints
+static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t length)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < length; i++)
+	{
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
 // Constructor takes in a file name and performs the parse
 Parser::Parser(const char* fileName, std::ostream* errStream,
-			   std::ostream* ASTStream, bool outputSymbols)
+			   std::ostream* ASTStream, bool outputSymbols,
+			   FunctionSink* sink)
 : mCurrToken(Token::Unknown)
+, mTokenHash(0)
 , mFileName(fileName)
-, mFileStream(fileName)
+, mStream(new std::ifstream(fileName))
 , mErrStream(errStream)
 , mASTStream(ASTStream)
+, mSink(sink)
 , mLineNumber(1)
 , mColNumber(1)
 , mUnusedIdent(nullptr)
+, mLexer(nullptr)
 , mNeedPrintf(false)
 , mCheckSemant(true) // PA2: Change to true
 , mOutputSymbols(outputSymbols)
 {
-	if (mFileStream.is_open())
+	if (!static_cast<std::ifstream*>(mStream.get())->is_open())
 	{
-		mLexer = new yyFlexLexer(&mFileStream);
-				
-		try
-		{
-			// Get the first token
-			consumeToken();
+		throw FileNotFound();
+	}
+	
+	parseInput();
+}
 
-			// Now start the parse
-			mRoot = parseProgram();
-		}
-		catch (ParseExcept& e)
-		{
-			reportError(e);
-		}
+// Performs the parse on an in-memory source buffer
+Parser::Parser(const char* fileName, const char* source, size_t length,
+			   std::ostream* errStream, std::ostream* ASTStream, bool outputSymbols)
+: mCurrToken(Token::Unknown)
+, mTokenHash(0)
+, mFileName(fileName)
+, mStream(new std::istringstream(std::string(source, length)))
+, mErrStream(errStream)
+, mASTStream(ASTStream)
+, mSink(nullptr)
+, mLineNumber(1)
+, mColNumber(1)
+, mUnusedIdent(nullptr)
+, mLexer(nullptr)
+, mNeedPrintf(false)
+, mCheckSemant(true)
+, mOutputSymbols(outputSymbols)
+{
+	parseInput();
+}
+
+void Parser::parseInput()
+{
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::AST);
+	mLexer = new yyFlexLexer(mStream.get());
+	
+	try
+	{
+		// Get the first token
+		consumeToken();
+
+		// Now start the parse
+		mRoot = parseProgram();
 	}
-	else
+	catch (ParseExcept& e)
 	{
-		throw FileNotFound();
+		reportError(e);
 	}
 	
-	if (!IsValid())
+	if (!IsValid() && mErrStream)
 	{
 		displayErrors();
 	}
@@ -103,6 +150,11 @@ void Parser::consumeToken(bool unknownIsExcept)
 	// this token.
 	if (mCurrToken != Token::Unknown)
 	{
+		// Fold the token into the current function's fingerprint
+		mTokenHash = hashBytes(mTokenHash, &mCurrToken, sizeof(mCurrToken));
+		mTokenHash = hashBytes(mTokenHash, mLexer->YYText(), mLexer->YYLeng());
+		
+
 		int len = Token::Lengths[mCurrToken];
 		if (len != -1)
 		{
@@ -266,6 +318,7 @@ void Parser::consumeUntil(const std::initializer_list<Token::Tokens>& list) noex
 // Helper functions to report syntax errors
 void Parser::reportError(const ParseExcept& except) noexcept
 {
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::Errors);
 	std::stringstream errStrm;
 	except.printException(errStrm);
 	mErrors.push_back(std::make_shared<Error>(errStrm.str(), mLineNumber, mColNumber));
@@ -273,6 +326,7 @@ void Parser::reportError(const ParseExcept& except) noexcept
 			
 void Parser::reportError(const std::string& msg) noexcept
 {
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::Errors);
 	mErrors.push_back(std::make_shared<Error>(msg, mLineNumber, mColNumber));
 }
 	
@@ -300,6 +354,7 @@ void Parser::reportSemantError(const std::string& msg, int colOverride, int line
 			line = lineOverride;
 		}
 		
+		uscc::opt::MemScope memScope(uscc::opt::MemTag::Errors);
 		mErrors.push_back(make_shared<Error>(msg, line, col));
 	}
 }
@@ -332,15 +387,15 @@ void Parser::displayErrors() noexcept
 	// Move the filestream back to the start
 	int lineNum = 0;
 	std::string lineTxt;
-	mFileStream.clear();
-	mFileStream.seekg(0, std::ios::beg);
+	mStream->clear();
+	mStream->seekg(0, std::ios::beg);
 	for (auto i = mErrors.begin();
 		 i != mErrors.end();
 		 ++i)
 	{
 		while (lineNum < (*i)->mLineNum)
 		{
-			std::getline(mFileStream, lineTxt);
+			std::getline(*mStream, lineTxt);
 			lineNum++;
 		}
 		
@@ -348,6 +403,29 @@ void Parser::displayErrors() noexcept
 	}
 }
 
+uint64_t Parser::getFingerprint() const noexcept
+{
+	uint64_t hash = mTokenHash;
+	// A change to the signature of a callee changes the IR
+	// of the call, even if this function's text is the same
+	for (Identifier* callee : mCallees)
+	{
+		hash = hashBytes(hash, callee->getName().c_str(), callee->getName().size() + 1);
+		shared_ptr<ASTFunction> func = callee->getFunction();
+		if (func)
+		{
+			Type type = func->getReturnType();
+			hash = hashBytes(hash, &type, sizeof(type));
+			for (unsigned int i = 1; i <= func->getNumArgs(); i++)
+			{
+				type = func->getArgType(i);
+				hash = hashBytes(hash, &type, sizeof(type));
+			}
+		}
+	}
+	return hash;
+}
+
 Identifier* Parser::getVariable(const char* name) noexcept
 {
 	// PA2 
@@ -449,7 +527,22 @@ shared_ptr<ASTProgram> Parser::parseProgram()
 	
 	while (func)
 	{
-		retVal->addFunction(func);
+		if (mSink)
+		{
+			// Once there's an error, nothing more will be compiled
+			if (IsValid())
+			{
+				mSink->functionParsed(func);
+			}
+			
+			// Only the function's signature is still needed (by callers)
+			func->releaseBody();
+			mSymbols.releaseScope(func->releaseScopeTable());
+		}
+		else
+		{
+			retVal->addFunction(func);
+		}
 		func = parseFunction();
 	}
 	
@@ -476,6 +569,8 @@ shared_ptr<ASTProgram> Parser::parseProgram()
 shared_ptr<ASTFunction> Parser::parseFunction()
 {
 	shared_ptr<ASTFunction> retVal;
+	SourceLoc loc(mLineNumber, mColNumber);
+	uscc::opt::TraceSpan span("parse");
 	
 	// Check for a return type
 	if (peekIsOneOf({Token::Key_void, Token::Key_int, Token::Key_char}))
@@ -498,6 +593,10 @@ shared_ptr<ASTFunction> Parser::parseFunction()
 		
 		mCurrReturnType = retType;
 		
+		// Start the fingerprint for this function
+		mTokenHash = FNV_OFFSET;
+		mCallees.clear();
+		
 		consumeToken();
 		
 		// Add a useful message if they're trying to return
@@ -566,6 +665,8 @@ shared_ptr<ASTFunction> Parser::parseFunction()
 		SymbolTable::ScopeTable* table = mSymbols.enterScope();
 		
 		retVal = make_shared<ASTFunction>(*ident, retType, *table);
+		retVal->setLoc(loc);
+		span.setFunction(ident->getName());
 		
 		// If this isn't the dummy function, hook up the node
 		if (!ident->isDummy())
@@ -654,6 +755,7 @@ shared_ptr<ASTFunction> Parser::parseFunction()
 		
 		// Add the compound statement to this function
 		retVal->setBody(funcCompoundStmt);
+		retVal->setFingerprint(getFingerprint());
 	}
 	
 	return retVal;
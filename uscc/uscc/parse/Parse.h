@@ -22,9 +22,11 @@
 
 #include "../scan/Tokens.h"
 #include <initializer_list>
-#include <fstream>
+#include <istream>
 #include <memory>
 #include <list>
+#include <vector>
+#include <cstdint>
 #include "ASTNodes.h"
 #include "ParseExcept.h"
 #include "Symbols.h"
@@ -43,8 +45,17 @@ class Parser
 	friend class Emitter;
 public:
 	// Constructor takes in a file name and performs the parse
+	// If sink is set, each function is handed to it (while the parse
+	// is still error free) and then freed, rather than being kept in the AST.
 	Parser(const char* fileName, std::ostream* errStream,
-		   std::ostream* ASTStream, bool outputSymbols);
+		   std::ostream* ASTStream, bool outputSymbols,
+		   FunctionSink* sink = nullptr);
+	
+	// Performs the parse on an in-memory source buffer of the given length.
+	// fileName is only used when displaying errors.
+	// errStream may be null, in which case errors are only available via GetErrors.
+	Parser(const char* fileName, const char* source, size_t length,
+		   std::ostream* errStream, std::ostream* ASTStream, bool outputSymbols);
 	
 	// Destructor not virtual; I don't expect any inheritance
 	~Parser();
@@ -60,6 +71,25 @@ public:
 		return mErrors.size();
 	}
 	
+	// Struct used to store an error
+	struct Error
+	{
+		Error(const std::string& msg, int lineNum, int colNum)
+		: mMsg(msg)
+		, mLineNum(lineNum)
+		, mColNum(colNum)
+		{ }
+		
+		std::string mMsg;
+		int mLineNum;
+		int mColNum;
+	};
+	
+	const std::list<std::shared_ptr<Error>>& GetErrors() const noexcept
+	{
+		return mErrors;
+	}
+	
 protected:
 	// Various helper functions
 	
@@ -127,26 +157,18 @@ protected:
 	void reportSemantError(const std::string& msg, int colOverride = -1,
 						   int lineOverride = -1) noexcept;
 	
-	// Struct used to store an error
-	struct Error
-	{
-		Error(const std::string& msg, int lineNum, int colNum)
-		: mMsg(msg)
-		, mLineNum(lineNum)
-		, mColNum(colNum)
-		{ }
-		
-		std::string mMsg;
-		int mLineNum;
-		int mColNum;
-	};
-	
 	// Write an error message to the error stream
 	void displayErrorMsg(const std::string& line, std::shared_ptr<Error> error) noexcept;
 	
 	// Writes out all the error messages
 	void displayErrors() noexcept;
 	
+	// Runs the parse over mStream (called by both constructors)
+	void parseInput();
+	
+	// Combines mTokenHash with the signatures in mCallees
+	uint64_t getFingerprint() const noexcept;
+	
 	// Gets the variable, if it exists. Otherwise
 	// reports a semant error and returns @@variable
 	Identifier* getVariable(const char* name) noexcept;
@@ -244,12 +266,14 @@ private:
 
 	// Name of the file we're parsing
 	const char* mFileName;
-	// File stream that we use to process the file
-	std::ifstream mFileStream;
-	// Ostream exceptions should be output to
+	// Stream that we use to process the file (or in-memory source)
+	std::unique_ptr<std::istream> mStream;
+	// Ostream exceptions should be output to (may be null)
 	std::ostream* mErrStream;
 	// Ostream for AST output
 	std::ostream* mASTStream;
+	// Receives functions as they're parsed (may be null)
+	FunctionSink* mSink;
 	
 	// Tracks the return type of the current function
 	Type mCurrReturnType;
@@ -257,6 +281,11 @@ private:
 	// Current active token
 	uscc::scan::Token::Tokens mCurrToken;
 	
+	// Hash of the tokens consumed so far in the current function
+	uint64_t mTokenHash;
+	// Functions called by the current function
+	std::vector<Identifier*> mCallees;
+	
 	// Keeps track of the line number in the file
 	unsigned int mLineNumber;
 	// Keeps track of the column number in the current line
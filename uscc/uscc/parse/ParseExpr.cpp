@@ -537,6 +537,7 @@ shared_ptr<ASTExpr> Parser::parseIdentFactor()
 					consumeToken();
 					// A function call can have zero or more arguments
 					shared_ptr<ASTFuncExpr> funcCall = make_shared<ASTFuncExpr>(*ident);
+					mCallees.push_back(ident);
 					retVal = funcCall;
 					
 					// Get the number of arguments for this function
@@ -208,6 +208,7 @@ shared_ptr<ASTDecl> Parser::parseDecl()
 shared_ptr<ASTStmt> Parser::parseStmt()
 {
 	shared_ptr<ASTStmt> retVal;
+	SourceLoc loc(mLineNumber, mColNumber);
 	try
 	{
 		// NOTE: AssignStmt HAS to go before ExprStmt!!
@@ -253,6 +254,11 @@ shared_ptr<ASTStmt> Parser::parseStmt()
 		retVal = make_shared<ASTNullStmt>();
 	}
 	
+	if (retVal)
+	{
+		retVal->setLoc(loc);
+	}
+	
 	return retVal;
 }
 
@@ -282,6 +288,8 @@ shared_ptr<ASTCompoundStmt> Parser::parseCompoundStmt(bool isFuncBody)
 			compoundStmt->addStmt(stmt);
 		}
 
+		// an implicit return is at the closing brace
+		SourceLoc endLoc(mLineNumber, mColNumber);
 		matchToken(Token::RBrace);
 
 		// PA2
@@ -290,7 +298,9 @@ shared_ptr<ASTCompoundStmt> Parser::parseCompoundStmt(bool isFuncBody)
 			auto returnStmt = std::dynamic_pointer_cast<ASTReturnStmt>(compoundStmt->getLastStmt());
 			if (!returnStmt) {
 				if (mCurrReturnType == Type::Void) {
-					compoundStmt->addStmt(make_shared<ASTReturnStmt>(nullptr));
+					auto implicitReturn = make_shared<ASTReturnStmt>(nullptr);
+					implicitReturn->setLoc(endLoc);
+					compoundStmt->addStmt(implicitReturn);
 				}
 				else {
 					reportSemantError("USC requires non-void functions to end with a return", mColNumber, mLineNumber-1);
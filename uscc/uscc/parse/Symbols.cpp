@@ -15,6 +15,7 @@
 
 #include "Symbols.h"
 #include "Emitter.h"
+#include "../opt/MemReport.h"
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wconversion"
@@ -123,6 +124,8 @@ void Identifier::writeTo(CodeContext& ctx, llvm::Value* value) noexcept
 
 SymbolTable::SymbolTable() noexcept
 {
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::Symbols);
+	
 	// PA2 
 
 	// root ScopeTable
@@ -171,6 +174,7 @@ Identifier* SymbolTable::createIdentifier(const char* name)
 		return getIdentifier(name);
 	}
 
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::Symbols);
 	Identifier* ident = new Identifier(name);
 	
 	// PA2
@@ -191,6 +195,7 @@ Identifier* SymbolTable::getIdentifier(const char* name)
 SymbolTable::ScopeTable* SymbolTable::enterScope()
 {
 	// PA2 
+	uscc::opt::MemScope memScope(uscc::opt::MemTag::Symbols);
 	ScopeTable* newScopeTable = new ScopeTable(mCurrScope);
 	mCurrScope = newScopeTable; 
 	return mCurrScope;
@@ -206,6 +211,16 @@ void SymbolTable::print(std::ostream& output) const noexcept
 	}
 }
 
+// Frees a scope (and its children) once nothing refers to
+// its identifiers anymore
+void SymbolTable::releaseScope(ScopeTable* scope)
+{
+	if (scope != mCurrScope && scope->getParent())
+	{
+		scope->getParent()->releaseChild(scope);
+	}
+}
+
 // Exits the current scope and moves the current scope back to
 // the previous scope table.
 void SymbolTable::exitScope()
@@ -240,6 +255,13 @@ SymbolTable::ScopeTable::~ScopeTable() noexcept
 	}
 }
 
+// Removes and deletes one of this scope's children
+void SymbolTable::ScopeTable::releaseChild(ScopeTable* child)
+{
+	mChildren.remove(child);
+	delete child;
+}
+
 // Adds the requested identifier to the table
 void SymbolTable::ScopeTable::addIdentifier(Identifier* ident)
 {
@@ -427,23 +449,25 @@ ConstStr* StringTable::getString(std::string& val) noexcept
 	}
 	else
 	{
+		uscc::opt::MemScope memScope(uscc::opt::MemTag::Symbols);
 		ConstStr* newStr = new ConstStr(val);
 		mStrings.emplace(val, newStr);
 		return newStr;
 	}
 }
 
-void StringTable::emitIR(CodeContext& ctx) noexcept
+// The global for a string is emitted the first time it's used, so
+// functions can be emitted before the whole file has been parsed
+llvm::Value* ConstStr::getValue(CodeContext& ctx) noexcept
 {
-	for (auto s : mStrings)
+	if (mValue == nullptr)
 	{
-		ConstStr* str = s.second;
 		// Make the llvm value for this string
-		llvm::Constant* strVal = llvm::ConstantDataArray::getString(ctx.mGlobal, str->mText);
+		llvm::Constant* strVal = llvm::ConstantDataArray::getString(ctx.mGlobal, mText);
 		
 		// Add this to the global table
 		llvm::ArrayType* type = llvm::ArrayType::get(llvm::Type::getInt8Ty(ctx.mGlobal),
-													 str->mText.size() + 1);
+													 mText.size() + 1);
 		
 		
 		llvm::GlobalValue* globVal =
@@ -455,6 +479,8 @@ void StringTable::emitIR(CodeContext& ctx) noexcept
 		// Strings are 1-aligned
 		//globVal->setAlignment(1);
 		
-		str->mValue = globVal;
+		mValue = globVal;
 	}
-}
\ No newline at end of file
+	
+	return mValue;
+}
@@ -156,6 +156,10 @@ public:
 	// Exits the current scope and moves the current scope back to
 	// the previous scope table.
 	void exitScope();
+	
+	// Deletes a scope that has been exited, along with its
+	// identifiers and child scopes
+	void releaseScope(ScopeTable* scope);
 
 	// Prints the symbol table to the specified stream
 	void print(std::ostream& output) const noexcept;
@@ -170,6 +174,9 @@ public:
 		// Adds the requested identifier to the table
 		void addIdentifier(Identifier* ident);
 		
+		// Removes and deletes a child scope
+		void releaseChild(ScopeTable* child);
+		
 		// Searches this scope for an identifier with
 		// the requested name. Returns nullptr if not found.
 		Identifier* searchInScope(const char* name) noexcept;
@@ -223,10 +230,8 @@ public:
 		return mText;
 	}
 	
-	llvm::Value* getValue() const noexcept
-	{
-		return mValue;
-	}
+	// Emits the global for this string if needed
+	llvm::Value* getValue(CodeContext& ctx) noexcept;
 private:
 	std::string mText;
 	llvm::Value* mValue;
@@ -242,9 +247,6 @@ public:
 	// If it exists, returns the corresponding ConstStr
 	// Otherwise, constructs a new ConstStr and returns that
 	ConstStr* getString(std::string& val) noexcept;
-	
-	// Emit this table to the IR contstants
-	void emitIR(CodeContext& ctx) noexcept;
 private:
 	std::unordered_map<std::string, ConstStr*> mStrings;
 };
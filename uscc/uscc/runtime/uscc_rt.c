@@ -0,0 +1,239 @@
+//
+//  uscc_rt.c
+//  uscc
+//
+//  The runtime that uscc links into programs (as bitcode)
+//  when they need it.
+//
+//  --instrument-functions: every function calls
+//  __uscc_func_enter/__uscc_func_exit with its ID, and a flat
+//  profile of calls and cycles per function is written to
+//  stderr (or to $USCC_PROFILE_OUT) when the program exits.
+//
+//  --buffered-output: printf calls with constant formats are
+//  lowered to the __uscc_print_* routines, which write to a
+//  buffer instead. It's written to stdout (so it stays in order
+//  with what's printed through stdio) when it fills up, before
+//  the remaining printf calls, and when the program exits.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Functions with a higher ID, or calls nested deeper than this,
+// are still run but aren't counted
+#define MAX_FUNCS 4096
+#define MAX_DEPTH 4096
+
+typedef struct
+{
+	const char* name;
+	uint64_t calls;
+	// Cycles spent in the function, including/not including its callees
+	uint64_t total;
+	uint64_t self;
+	// Number of calls currently running, so recursive calls
+	// don't count toward total more than once
+	uint64_t active;
+} FuncProfile;
+
+typedef struct
+{
+	uint64_t start;
+	// Cycles spent in the functions this one called
+	uint64_t children;
+} Frame;
+
+static FuncProfile funcs[MAX_FUNCS];
+static unsigned numFuncs;
+static Frame stack[MAX_DEPTH];
+static unsigned depth;
+
+void __uscc_func_enter(int id, const char* name)
+{
+	if ((unsigned)id < MAX_FUNCS)
+	{
+		FuncProfile* func = &funcs[id];
+		func->name = name;
+		func->calls++;
+		func->active++;
+		if ((unsigned)id >= numFuncs)
+		{
+			numFuncs = (unsigned)id + 1;
+		}
+	}
+	if (depth < MAX_DEPTH)
+	{
+		stack[depth].children = 0;
+		stack[depth].start = __builtin_readcyclecounter();
+	}
+	depth++;
+}
+
+void __uscc_func_exit(int id)
+{
+	uint64_t now = __builtin_readcyclecounter();
+	depth--;
+	if (depth >= MAX_DEPTH)
+	{
+		return;
+	}
+
+	uint64_t elapsed = now - stack[depth].start;
+	if ((unsigned)id < MAX_FUNCS)
+	{
+		FuncProfile* func = &funcs[id];
+		func->self += elapsed - stack[depth].children;
+		if (--func->active == 0)
+		{
+			func->total += elapsed;
+		}
+	}
+	if (depth > 0)
+	{
+		stack[depth - 1].children += elapsed;
+	}
+}
+
+// Sorts by self cycles, most first
+static int compareSelf(const void* a, const void* b)
+{
+	const FuncProfile* funcA = *(const FuncProfile* const*)a;
+	const FuncProfile* funcB = *(const FuncProfile* const*)b;
+	if (funcA->self != funcB->self)
+	{
+		return funcA->self < funcB->self ? 1 : -1;
+	}
+	return 0;
+}
+
+__attribute__((destructor))
+static void writeFlatProfile(void)
+{
+	if (numFuncs == 0)
+	{
+		return;
+	}
+
+	FILE* out = stderr;
+	const char* outName = getenv("USCC_PROFILE_OUT");
+	if (outName && (out = fopen(outName, "w")) == NULL)
+	{
+		return;
+	}
+
+	const FuncProfile* sorted[MAX_FUNCS];
+	unsigned count = 0;
+	uint64_t allSelf = 0;
+	for (unsigned i = 0; i < numFuncs; i++)
+	{
+		if (funcs[i].calls > 0)
+		{
+			sorted[count++] = &funcs[i];
+			allSelf += funcs[i].self;
+		}
+	}
+	qsort(sorted, count, sizeof(sorted[0]), compareSelf);
+
+	fprintf(out, "Flat profile (cycles):\n");
+	fprintf(out, "%7s %16s %16s %12s %12s  %s\n",
+			"% self", "self", "total", "calls", "self/call", "function");
+	for (unsigned i = 0; i < count; i++)
+	{
+		const FuncProfile* func = sorted[i];
+		double percent = allSelf ? 100.0 * (double)func->self / (double)allSelf : 0.0;
+		fprintf(out, "%7.2f %16llu %16llu %12llu %12llu  %s\n", percent,
+				(unsigned long long)func->self, (unsigned long long)func->total,
+				(unsigned long long)func->calls,
+				(unsigned long long)(func->self / func->calls), func->name);
+	}
+
+	if (out != stderr)
+	{
+		fclose(out);
+	}
+}
+
+#define OUT_BUFFER_SIZE 65536
+
+static char outBuffer[OUT_BUFFER_SIZE];
+static unsigned outLength;
+
+void __uscc_flush(void)
+{
+	if (outLength > 0)
+	{
+		fwrite(outBuffer, 1, outLength, stdout);
+		outLength = 0;
+	}
+}
+
+// Makes room for length more characters
+static void reserve(unsigned length)
+{
+	if (outLength + length > OUT_BUFFER_SIZE)
+	{
+		__uscc_flush();
+	}
+}
+
+void __uscc_print_lit(const char* text, int length)
+{
+	if ((unsigned)length > OUT_BUFFER_SIZE)
+	{
+		__uscc_flush();
+		fwrite(text, 1, (unsigned)length, stdout);
+		return;
+	}
+	reserve((unsigned)length);
+	memcpy(outBuffer + outLength, text, (unsigned)length);
+	outLength += (unsigned)length;
+}
+
+void __uscc_print_str(const char* str)
+{
+	__uscc_print_lit(str, (int)strlen(str));
+}
+
+void __uscc_print_char(int c)
+{
+	reserve(1);
+	outBuffer[outLength++] = (char)c;
+}
+
+void __uscc_print_int(int value)
+{
+	// Digits come out backwards
+	char digits[10];
+	unsigned numDigits = 0;
+	unsigned magnitude = value < 0 ? 0u - (unsigned)value : (unsigned)value;
+	do
+	{
+		digits[numDigits++] = (char)('0' + magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude > 0);
+
+	reserve(numDigits + 1);
+	if (value < 0)
+	{
+		outBuffer[outLength++] = '-';
+	}
+	while (numDigits > 0)
+	{
+		outBuffer[outLength++] = digits[--numDigits];
+	}
+}
+
+__attribute__((destructor))
+static void flushOutput(void)
+{
+	__uscc_flush();
+}
@@ -0,0 +1,150 @@
+#---------------------------------------------------------
+# Copyright (c) 2014, Sanjay Madhav
+# All rights reserved.
+#
+# This file is distributed under the BSD license.
+# See LICENSE.TXT for details.
+#---------------------------------------------------------
+# Benchmarks uscc on a generated program with many functions,
+# and reports functions per second for each thread count.
+#
+# Usage: python bench.py [numFunctions] [maxJobs] [extra uscc flags...]
+#
+# With "levels", compares the optimization levels instead: how long
+# uscc takes to compile the program at each one, and how long the
+# result takes to run in lli.
+#
+# Usage: python bench.py levels [numFunctions] [extra uscc flags...]
+#
+# Each level's times are also given relative to -O0, so the extra
+# compile time can be weighed against how much faster the result runs.
+import subprocess
+import os
+import sys
+import time
+
+uscc = "../bin/uscc"
+lli = "../../bin/lli"
+benchFile = "bench.tmp.usc"
+
+# Each function has a loop (for LICM) and constant expressions
+# (for constant propagation and branch folding)
+funcTemplate = """
+int func%(n)d(int x)
+{
+	int i = 0;
+	int sum = 0;
+	int scale = 2 * 3 + %(n)d;
+	while (i < x)
+	{
+		if (scale > 5)
+		{
+			sum = sum + i * scale;
+		}
+		else
+		{
+			sum = sum - i;
+		}
+		++i;
+	}
+	return sum;
+}
+"""
+
+# Dot product of two arrays, many times over (for the vectorizers)
+kernel = """
+int kernel(int reps)
+{
+	int a[256];
+	int b[256];
+	int i = 0;
+	int j = 0;
+	int sum = 0;
+	while (i < 256)
+	{
+		a[i] = i;
+		b[i] = 256 - i;
+		++i;
+	}
+	while (j < reps)
+	{
+		i = 0;
+		while (i < 256)
+		{
+			sum = sum + a[i] * b[i];
+			++i;
+		}
+		++j;
+	}
+	return sum;
+}
+"""
+
+def writeProgram(numFuncs, withKernel = False):
+	out = open(benchFile, "w")
+	for n in range(numFuncs):
+		out.write(funcTemplate % {"n": n})
+	if withKernel:
+		out.write(kernel)
+	out.write("\nint main()\n{\n\tint total = 0;\n")
+	for n in range(numFuncs):
+		out.write("\ttotal = total + func%d(10);\n" % n)
+	if withKernel:
+		out.write("\ttotal = total + kernel(100000);\n")
+	out.write("\tprintf(\"%d\\n\", total);\n\treturn 0;\n}\n")
+	out.close()
+
+def bench(numFuncs, jobs, flags):
+	start = time.time()
+	subprocess.check_call([uscc, "-O", "-j", str(jobs)] + flags + [benchFile])
+	return time.time() - start
+
+def timeCall(args):
+	start = time.time()
+	subprocess.check_call(args, stdout=open(os.devnull, "w"))
+	return time.time() - start
+
+def benchLevels(numFuncs, flags):
+	if not os.path.isfile(lli):
+		raise Exception("lli not found at ../../bin/lli")
+	writeProgram(numFuncs, True)
+	bcFile = benchFile.replace(".usc", ".bc")
+	
+	print("%d functions, plus an array kernel" % numFuncs)
+	print("level\tcompile\trun\tcompile cost\trun speedup")
+	baseline = None
+	for level in ["", "-O1", "-O2", "-O3"]:
+		compileTime = timeCall([uscc] + ([level] if level else []) + flags + [benchFile])
+		runTime = timeCall([lli, bcFile])
+		if baseline is None:
+			baseline = (compileTime, runTime)
+		print("%s\t%.3f\t%.3f\t%.2fx\t\t%.2fx" % (level if level else "-O0", compileTime, runTime,
+			compileTime / baseline[0], baseline[1] / runTime))
+	
+	os.remove(benchFile)
+	os.remove(bcFile)
+
+if __name__ == '__main__':
+	if not os.path.isfile(uscc):
+		raise Exception("Can't run without uscc")
+	if len(sys.argv) > 1 and sys.argv[1] == "levels":
+		benchLevels(int(sys.argv[2]) if len(sys.argv) > 2 else 200, sys.argv[3:])
+		sys.exit(0)
+	numFuncs = int(sys.argv[1]) if len(sys.argv) > 1 else 2000
+	maxJobs = int(sys.argv[2]) if len(sys.argv) > 2 else 8
+	flags = sys.argv[3:]
+	writeProgram(numFuncs)
+	
+	jobs = 1
+	baseline = None
+	print("%d functions" % numFuncs)
+	print("jobs\tseconds\tfuncs/sec\tspeedup")
+	while jobs <= maxJobs:
+		elapsed = bench(numFuncs, jobs, flags)
+		if baseline is None:
+			baseline = elapsed
+		print("%d\t%.3f\t%.1f\t\t%.2fx" % (jobs, elapsed, numFuncs / elapsed, baseline / elapsed))
+		jobs *= 2
+	
+	os.remove(benchFile)
+	os.remove(benchFile.replace(".usc", ".bc"))
@@ -0,0 +1,36 @@
+#---------------------------------------------------------
+# Copyright (c) 2014, Sanjay Madhav
+# All rights reserved.
+#
+# This file is distributed under the BSD license.
+# See LICENSE.TXT for details.
+#---------------------------------------------------------
+import subprocess
+import os
+import sys
+
+import unittest
+apitest = "../bin/uscc_apitest"
+
+__unittest = True
+
+class ApiTests(unittest.TestCase):
+	
+	def setUp(self):
+		self.maxDiff = None
+		if not os.path.isfile(apitest):
+			raise Exception("Can't run without uscc_apitest")
+
+	def test_Api_compile(self):
+		# The library compiles in memory, so nothing should appear here
+		before = sorted(os.listdir("."))
+		try:
+			resultStr = subprocess.check_output([apitest], stderr=subprocess.STDOUT,
+				universal_newlines=True)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+		self.assertEqual("OK\n", resultStr)
+		self.assertEqual(before, sorted(os.listdir(".")))
+
+if __name__ == '__main__':
+	unittest.main(verbosity=2)
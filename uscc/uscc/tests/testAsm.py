@@ -23,14 +23,14 @@ class AsmTests(unittest.TestCase):
 		if not os.path.isfile(uscc):
 			raise Exception("Can't run without uscc")
 
-	def checkEmit(self, fileName):
+	def checkEmit(self, fileName, flags = []):
 		# read in expected
 		expectFile = open("expected/" + fileName + ".output", "r")
 		expectedStr = expectFile.read()
 		expectFile.close()
 		# first compile to asm via uscc
 		try:
-			resultStr = subprocess.check_output([uscc, "-s", fileName + ".usc"], stderr=subprocess.STDOUT)
+			resultStr = subprocess.check_output([uscc, "-s"] + flags + [fileName + ".usc"], stderr=subprocess.STDOUT)
 		except subprocess.CalledProcessError as e:
 			self.fail("\n" + e.output)
 		
@@ -49,6 +49,36 @@ class AsmTests(unittest.TestCase):
 		except subprocess.CalledProcessError as e:
 			self.fail("\n" + e.output)
 			
+	def checkSplit(self, fileName, flags = []):
+		# read in expected
+		expectFile = open("expected/" + fileName + ".output", "r")
+		expectedStr = expectFile.read()
+		expectFile.close()
+		# compile each function separately, on one thread and on several
+		try:
+			subprocess.check_output([uscc, "-s", "--split-codegen", "-j", "1", "-o", fileName + ".j1.s"] + flags + [fileName + ".usc"], stderr=subprocess.STDOUT)
+			subprocess.check_output([uscc, "-s", "--split-codegen", "-j", "4", "-o", fileName + ".s"] + flags + [fileName + ".usc"], stderr=subprocess.STDOUT)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+		
+		# the number of threads shouldn't change the output
+		singleStr = open(fileName + ".j1.s", "r").read()
+		splitStr = open(fileName + ".s", "r").read()
+		self.assertMultiLineEqual(singleStr, splitStr)
+		
+		# now assemble into machine code (via gcc)
+		try:
+			subprocess.check_output([gcc, "-no-pie", fileName + ".s", "-o", fileName + ".out"], stderr=subprocess.STDOUT)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+
+		# now try running and compare output
+		try:
+			resultStr = subprocess.check_output(["./" + fileName + ".out"], stderr=subprocess.STDOUT)
+			self.assertMultiLineEqual(expectedStr, resultStr)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+			
 	def test_Asm_emit02(self):
 		self.checkEmit("emit02")
 		
@@ -82,6 +112,9 @@ class AsmTests(unittest.TestCase):
 	def test_Asm_emit12(self):
 		self.checkEmit("emit12")
 		
+	def test_Asm_emit13(self):
+		self.checkEmit("emit13")
+		
 	def test_Asm_quicksort(self):
 		self.checkEmit("quicksort")
 		
@@ -111,5 +144,58 @@ class AsmTests(unittest.TestCase):
 		
 	def test_Asm_opt07(self):
 		self.checkEmit("opt07")
+		
+	def test_Asm_split_emit12(self):
+		self.checkSplit("emit12")
+		
+	def test_Asm_split_quicksort(self):
+		self.checkSplit("quicksort")
+		
+	def test_Asm_split_quicksort_O(self):
+		self.checkSplit("quicksort", ["-O"])
+		
+	def test_Asm_quicksort_debug(self):
+		self.checkEmit("quicksort", ["-g", "-O", "-j", "4"])
+		# the line tables refer to quicksort.usc
+		asmFile = open("quicksort.s", "r")
+		asmStr = asmFile.read()
+		asmFile.close()
+		self.assertTrue("quicksort.usc" in asmStr)
+		self.assertTrue("\t.loc\t" in asmStr)
+		
+	def test_Asm_split_module_state(self):
+		# these need globals and destructors shared by the whole program,
+		# which the partitions can't split up, so they're rejected
+		for flag in [["--buffered-output"], ["--instrument-functions"],
+					 ["--profile-generate", "emit12.profile"]]:
+			proc = subprocess.Popen([uscc, "-s", "--split-codegen"] + flag + ["emit12.usc"],
+				stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+			output = proc.communicate()[0]
+			self.assertNotEqual(0, proc.returncode)
+			self.assertTrue("can't be used with --split-codegen" in output)
+		
+	def test_Asm_quicksort_object(self):
+		# with -s and -c, the object file is assembled from the .s
+		expectFile = open("expected/quicksort.output", "r")
+		expectedStr = expectFile.read()
+		expectFile.close()
+		try:
+			subprocess.check_output([uscc, "-s", "-c", "-O", "quicksort.usc"], stderr=subprocess.STDOUT)
+			subprocess.check_output([gcc, "-no-pie", "quicksort.o", "-o", "quicksort.out"], stderr=subprocess.STDOUT)
+			resultStr = subprocess.check_output(["./quicksort.out"], stderr=subprocess.STDOUT)
+			self.assertMultiLineEqual(expectedStr, resultStr)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+		self.assertTrue(os.path.isfile("quicksort.s"))
+		
+	def test_Asm_write_failed(self):
+		# the output directory doesn't exist, so nothing can be written
+		for flags in [["-s"], ["-s", "--split-codegen"], ["-c"]]:
+			proc = subprocess.Popen([uscc] + flags + ["-o", "nodir/emit12.out", "emit12.usc"],
+				stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+			output = proc.communicate()[0]
+			self.assertNotEqual(0, proc.returncode)
+			self.assertTrue("Compilation halted." in output)
+		
 if __name__ == '__main__':
 	unittest.main(verbosity=2)
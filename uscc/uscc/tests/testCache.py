@@ -0,0 +1,92 @@
+#---------------------------------------------------------
+# Copyright (c) 2014, Sanjay Madhav
+# All rights reserved.
+#
+# This file is distributed under the BSD license.
+# See LICENSE.TXT for details.
+#---------------------------------------------------------
+import subprocess
+import os
+import sys
+import shutil
+
+import unittest
+uscc = "../bin/uscc"
+cacheDir = "cache.tmp"
+
+__unittest = True
+
+class CacheTests(unittest.TestCase):
+	
+	def setUp(self):
+		self.maxDiff = None
+		if not os.path.isfile(uscc):
+			raise Exception("Can't run without uscc")
+		shutil.rmtree(cacheDir, True)
+		
+	def tearDown(self):
+		shutil.rmtree(cacheDir, True)
+
+	def runCached(self, fileName, flags):
+		try:
+			return subprocess.check_output([uscc, "--run", "--cache-dir", cacheDir] + flags + [fileName + ".usc"], stderr=subprocess.STDOUT)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+
+	def ageEntries(self):
+		# backdate every entry, so a rewrite shows up as a new mtime
+		entries = os.listdir(cacheDir)
+		for entry in entries:
+			os.utime(os.path.join(cacheDir, entry), (0, 0))
+		return set(entries)
+		
+	def rewrittenEntries(self, entries):
+		return [e for e in entries if os.stat(os.path.join(cacheDir, e)).st_mtime != 0]
+
+	def checkCache(self, fileName, flags = []):
+		# read in expected
+		expectFile = open("expected/" + fileName + ".output", "r")
+		expectedStr = expectFile.read()
+		expectFile.close()
+		# first compile fills the cache, second one uses it
+		self.assertMultiLineEqual(expectedStr, self.runCached(fileName, flags))
+		entries = self.ageEntries()
+		self.assertNotEqual(0, len(entries))
+		self.assertMultiLineEqual(expectedStr, self.runCached(fileName, flags))
+		# every function was a hit, so nothing was added or written again
+		self.assertEqual(entries, set(os.listdir(cacheDir)))
+		self.assertEqual([], self.rewrittenEntries(entries))
+			
+	def test_Cache_emit12(self):
+		self.checkCache("emit12")
+		
+	def test_Cache_quicksort(self):
+		self.checkCache("quicksort")
+		
+	def test_Cache_quicksort_O(self):
+		self.checkCache("quicksort", ["-O"])
+		
+	def test_Cache_quicksort_edit(self):
+		expectFile = open("expected/quicksort.output", "r")
+		expectedStr = expectFile.read()
+		expectFile.close()
+		self.assertMultiLineEqual(expectedStr, self.runCached("quicksort", []))
+		entries = self.ageEntries()
+		# change only main, without changing what it prints
+		source = open("quicksort.usc", "r").read()
+		self.assertTrue("\treturn 0;" in source)
+		editFile = open("quicksort_edit.usc", "w")
+		editFile.write(source.replace("\treturn 0;", "\treturn 0 * 1;"))
+		editFile.close()
+		try:
+			self.assertMultiLineEqual(expectedStr, self.runCached("quicksort_edit", []))
+		finally:
+			os.remove("quicksort_edit.usc")
+		# main gets a new entry, and the other functions' entries are hits
+		after = set(os.listdir(cacheDir))
+		self.assertEqual(1, len(after - entries))
+		self.assertTrue(entries <= after)
+		self.assertEqual([], self.rewrittenEntries(entries))
+		
+if __name__ == '__main__':
+	unittest.main(verbosity=2)
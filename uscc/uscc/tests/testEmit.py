@@ -75,6 +75,9 @@ class EmitTests(unittest.TestCase):
 	def test_Emit_emit12(self):
 		self.checkEmit("emit12")
 		
+	def test_Emit_emit13(self):
+		self.checkEmit("emit13")
+		
 	def test_Emit_quicksort(self):
 		self.checkEmit("quicksort")
 		
@@ -8,6 +8,8 @@
 import subprocess
 import os
 import sys
+import json
+import re
 
 import unittest
 uscc = "../bin/uscc"
@@ -24,14 +26,14 @@ class EmitTests(unittest.TestCase):
 		if not os.path.isfile(lli):
 			raise Exception("lli not found at ../../bin/lli")
 
-	def checkEmit(self, fileName):
+	def checkEmit(self, fileName, flags = []):
 		# read in expected
 		expectFile = open("expected/" + fileName + ".output", "r")
 		expectedStr = expectFile.read()
 		expectFile.close()
 		# first compile the .bc using uscc
 		try:
-			subprocess.check_call([uscc, "-O", fileName + ".usc"], stderr=subprocess.STDOUT)
+			subprocess.check_call([uscc, "-O"] + flags + [fileName + ".usc"], stderr=subprocess.STDOUT)
 		except subprocess.CalledProcessError as e:
 			self.fail("\n" + e.output)
 		
@@ -75,6 +77,9 @@ class EmitTests(unittest.TestCase):
 	def test_Emit_emit12(self):
 		self.checkEmit("emit12")
 		
+	def test_Emit_emit13(self):
+		self.checkEmit("emit13")
+		
 	def test_Emit_quicksort(self):
 		self.checkEmit("quicksort")
 		
@@ -104,5 +109,142 @@ class EmitTests(unittest.TestCase):
 		
 	def test_Emit_opt07(self):
 		self.checkEmit("opt07")
+		
+	def test_Emit_opt08(self):
+		self.checkEmit("opt08")
+		
+	def test_Emit_opt09(self):
+		self.checkEmit("opt09")
+		
+	def test_Emit_opt10(self):
+		self.checkEmit("opt10")
+		
+	def test_Emit_opt11(self):
+		self.checkEmit("opt11")
+		
+	def test_Emit_opt12(self):
+		self.checkEmit("opt12")
+		
+	def test_Emit_opt12_unroll(self):
+		self.checkEmit("opt12", ["--unroll", "4"])
+		
+	def test_Emit_opt10_O3(self):
+		self.checkEmit("opt10", ["-O3"])
+		
+	def test_Emit_opt12_O2(self):
+		self.checkEmit("opt12", ["-O2"])
+		
+	def test_Emit_opt10_passes(self):
+		self.checkEmit("opt10", ["--passes", "tailrec,[constops,constbr,deadblocks,adce,cfgsimplify]*3,licm"])
+		
+	def test_Emit_opt12_passes(self):
+		self.checkEmit("opt12", ["--unroll", "2", "--passes", "[constops,constbr,deadblocks],licm,[unroll,cfgsimplify]"])
+		
+	def test_Emit_opt01_stats(self):
+		self.checkEmit("opt01", ["--stats", "opt01.stats.json"])
+		statsFile = open("opt01.stats.json", "r")
+		stats = json.load(statsFile)
+		statsFile.close()
+		os.remove("opt01.stats.json")
+		main = [f for f in stats["functions"] if f["name"] == "main"][0]
+		self.assertEqual(1, main["passes"]["constbr"]["branches folded"])
+		self.assertTrue("trivial phis removed" in main["passes"]["ssa"])
+		
+	def test_Emit_opt12_profile(self):
+		# build with counters, and run it to write the profile
+		self.checkEmit("opt12", ["--profile-generate", "opt12.profile"])
+		profileFile = open("opt12.profile", "r")
+		header = profileFile.readline()
+		profileFile.close()
+		self.assertEqual("uscc-profile 1\n", header)
+		# then build with the profile
+		self.checkEmit("opt12", ["-O3", "--unroll", "4", "--profile-use", "opt12.profile"])
+		try:
+			irStr = subprocess.check_output([uscc, "-O", "-p", "--profile-use", "opt12.profile",
+				"opt12.usc"], stderr=subprocess.STDOUT, universal_newlines=True)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+		os.remove("opt12.profile")
+		# the loop branch in sumSquares has the counts as weights
+		body = irStr[irStr.index("define i32 @sumSquares"):]
+		body = body[:body.index("\n}\n")]
+		prof = re.search(r"\bbr i1 .*!prof (!\d+)", body)
+		self.assertTrue(prof is not None)
+		self.assertTrue(re.search("^" + prof.group(1) + r" = .*\"branch_weights\"", irStr,
+			re.MULTILINE) is not None)
+		# and neverCalled is marked cold
+		attrs = re.search(r"define i32 @neverCalled\([^)]*\) (#\d+)", irStr)
+		self.assertTrue(attrs is not None)
+		self.assertTrue(re.search("^attributes " + attrs.group(1) + r" = \{[^}]*\bcold\b", irStr,
+			re.MULTILINE) is not None)
+		
+	def test_Emit_opt01_trace(self):
+		self.checkEmit("opt01", ["--trace", "opt01.trace.json"])
+		traceFile = open("opt01.trace.json", "r")
+		trace = json.load(traceFile)
+		traceFile.close()
+		os.remove("opt01.trace.json")
+		spans = [(e["name"], e.get("args", {}).get("function")) for e in trace["traceEvents"]]
+		self.assertTrue(("parse", "main") in spans)
+		self.assertTrue(("emit", "main") in spans)
+		self.assertTrue(("constbr", "main") in spans)
+		
+	def test_Emit_opt12_trace_O2(self):
+		# tracing mustn't change which passes run, or how they're grouped
+		try:
+			plain = subprocess.check_output([uscc, "-O2", "-p", "opt12.usc"],
+				stderr=subprocess.STDOUT, universal_newlines=True)
+			traced = subprocess.check_output([uscc, "-O2", "-p", "--trace", "opt12.trace.json", "opt12.usc"],
+				stderr=subprocess.STDOUT, universal_newlines=True)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+		traceFile = open("opt12.trace.json", "r")
+		trace = json.load(traceFile)
+		traceFile.close()
+		os.remove("opt12.trace.json")
+		self.assertMultiLineEqual(plain, traced)
+		names = [e["name"] for e in trace["traceEvents"]]
+		self.assertTrue("loop passes" in names)
+		
+	def test_Emit_opt01_mem_report(self):
+		try:
+			output = subprocess.check_output([uscc, "-O", "--mem-report", "opt01.usc"],
+				stderr=subprocess.STDOUT, universal_newlines=True)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+		# the live bytes for each subsystem, after each phase
+		live = {}
+		for line in output.splitlines():
+			if line.startswith("Memory after "):
+				phase = live.setdefault(line[len("Memory after "):-1], {})
+			elif line and line[-1].isdigit():
+				fields = line.rsplit(None, 4)
+				phase[fields[0]] = int(fields[1])
+		self.assertTrue(live["parse"]["ast"] > 0)
+		self.assertTrue(live["parse"]["symbols"] > 0)
+		self.assertTrue(live["emit"]["llvm ir"] > 0)
+		self.assertTrue("optimize" in live)
+		# there was no code generation, so no report for it
+		self.assertFalse("codegen" in live)
+		
+	def test_Emit_emit03_printf(self):
+		self.checkEmit("emit03", ["--stats", "emit03.stats.json"])
+		statsFile = open("emit03.stats.json", "r")
+		stats = json.load(statsFile)
+		statsFile.close()
+		os.remove("emit03.stats.json")
+		main = [f for f in stats["functions"] if f["name"] == "main"][0]
+		self.assertTrue(main["passes"]["printf"]["calls to print int"] > 0)
+		
+	def test_Emit_emit03_printf_jobs(self):
+		# the helper is only declared in each function's own module, so
+		# this checks that the optimized main is still spliced back in
+		self.checkEmit("emit03", ["-j", "4", "--stats", "emit03.jobs.stats.json"])
+		statsFile = open("emit03.jobs.stats.json", "r")
+		stats = json.load(statsFile)
+		statsFile.close()
+		os.remove("emit03.jobs.stats.json")
+		main = [f for f in stats["functions"] if f["name"] == "main"][0]
+		self.assertTrue(main["passes"]["printf"]["calls to print int"] > 0)
 if __name__ == '__main__':
 	unittest.main(verbosity=2)
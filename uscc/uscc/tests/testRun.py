@@ -0,0 +1,81 @@
+#---------------------------------------------------------
+# Copyright (c) 2014, Sanjay Madhav
+# All rights reserved.
+#
+# This file is distributed under the BSD license.
+# See LICENSE.TXT for details.
+#---------------------------------------------------------
+import subprocess
+import os
+import sys
+
+import unittest
+uscc = "../bin/uscc"
+
+__unittest = True
+
+class RunTests(unittest.TestCase):
+	
+	def setUp(self):
+		self.maxDiff = None
+		if not os.path.isfile(uscc):
+			raise Exception("Can't run without uscc")
+
+	def checkRun(self, fileName, exitCode = 0, flags = []):
+		# read in expected
+		expectFile = open("expected/" + fileName + ".output", "r")
+		expectedStr = expectFile.read()
+		expectFile.close()
+		# JIT and run in-process via uscc
+		proc = subprocess.Popen([uscc, "--run"] + flags + [fileName + ".usc"], stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+		resultStr = proc.communicate()[0]
+		self.assertMultiLineEqual(expectedStr, resultStr)
+		self.assertEqual(exitCode, proc.returncode)
+			
+	def test_Run_emit02(self):
+		self.checkRun("emit02")
+		
+	def test_Run_emit06(self):
+		self.checkRun("emit06")
+		
+	def test_Run_emit12(self):
+		self.checkRun("emit12")
+		
+	def test_Run_quicksort(self):
+		self.checkRun("quicksort")
+		
+	def test_Run_quicksort_parallel(self):
+		self.checkRun("quicksort", 0, ["-O", "-j", "4"])
+		
+	def test_Run_opt07_parallel(self):
+		self.checkRun("opt07", 0, ["-O", "-j", "4"])
+		
+	def test_Run_run01(self):
+		self.checkRun("run01", 3)
+		
+	def test_Run_quicksort_instrumented(self):
+		env = dict(os.environ)
+		env["USCC_PROFILE_OUT"] = "quicksort.flat"
+		expectFile = open("expected/quicksort.output", "r")
+		expectedStr = expectFile.read()
+		expectFile.close()
+		proc = subprocess.Popen([uscc, "--run", "-O", "--instrument-functions", "quicksort.usc"], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, env=env)
+		resultStr = proc.communicate()[0]
+		self.assertMultiLineEqual(expectedStr, resultStr)
+		self.assertEqual(0, proc.returncode)
+		# every function that ran shows up in the profile
+		profileFile = open("quicksort.flat", "r")
+		profileStr = profileFile.read()
+		profileFile.close()
+		os.remove("quicksort.flat")
+		self.assertTrue(profileStr.startswith("Flat profile (cycles):"))
+		self.assertTrue(" main\n" in profileStr)
+		
+	def test_Run_emit10_buffered(self):
+		self.checkRun("emit10", 0, ["--buffered-output"])
+		
+	def test_Run_emit12_buffered(self):
+		self.checkRun("emit12", 0, ["-O", "--buffered-output"])
+		
+if __name__ == '__main__':
+	unittest.main(verbosity=2)
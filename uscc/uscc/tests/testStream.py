@@ -0,0 +1,65 @@
+#---------------------------------------------------------
+# Copyright (c) 2014, Sanjay Madhav
+# All rights reserved.
+#
+# This file is distributed under the BSD license.
+# See LICENSE.TXT for details.
+#---------------------------------------------------------
+import subprocess
+import os
+import sys
+
+import unittest
+uscc = "../bin/uscc"
+gcc = "gcc"
+
+__unittest = True
+
+class StreamTests(unittest.TestCase):
+	
+	def setUp(self):
+		self.maxDiff = None
+		if not os.path.isfile(uscc):
+			raise Exception("Can't run without uscc")
+
+	def checkStream(self, fileName, flags = []):
+		# read in expected
+		expectFile = open("expected/" + fileName + ".output", "r")
+		expectedStr = expectFile.read()
+		expectFile.close()
+		# compile to asm one function at a time
+		try:
+			subprocess.check_output([uscc, "--stream", "-s"] + flags + [fileName + ".usc"], stderr=subprocess.STDOUT)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+		
+		# now assemble into machine code (via gcc)
+		try:
+			subprocess.check_output([gcc, "-no-pie", fileName + ".s", "-o", fileName + ".out"], stderr=subprocess.STDOUT)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+
+		# now try running and compare output
+		try:
+			resultStr = subprocess.check_output(["./" + fileName + ".out"], stderr=subprocess.STDOUT)
+			self.assertMultiLineEqual(expectedStr, resultStr)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+			
+	def test_Stream_emit02(self):
+		self.checkStream("emit02")
+		
+	def test_Stream_emit12(self):
+		self.checkStream("emit12")
+		
+	def test_Stream_quicksort(self):
+		self.checkStream("quicksort")
+		
+	def test_Stream_quicksort_O(self):
+		self.checkStream("quicksort", ["-O"])
+		
+	def test_Stream_opt07_O(self):
+		self.checkStream("opt07", ["-O"])
+		
+if __name__ == '__main__':
+	unittest.main(verbosity=2)
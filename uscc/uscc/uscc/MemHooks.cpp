@@ -0,0 +1,89 @@
+//
+//  MemHooks.cpp
+//  uscc
+//
+//  Replaces the global operator new and delete, so that
+//  --mem-report can see every allocation (see opt/MemReport.h).
+//  When it's off, these just call malloc and free.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#include "../opt/MemReport.h"
+#include <cstdlib>
+#include <new>
+
+using uscc::opt::MemReport;
+
+static void* allocate(size_t size) noexcept
+{
+	void* ptr = std::malloc(size ? size : 1);
+	if (ptr && MemReport::enabled())
+	{
+		MemReport::recordAlloc(ptr, size);
+	}
+	return ptr;
+}
+
+static void deallocate(void* ptr) noexcept
+{
+	if (ptr == nullptr)
+	{
+		return;
+	}
+	if (MemReport::enabled())
+	{
+		MemReport::recordFree(ptr);
+	}
+	std::free(ptr);
+}
+
+void* operator new(size_t size)
+{
+	void* ptr = allocate(size);
+	if (ptr == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	deallocate(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	deallocate(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	deallocate(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	deallocate(ptr);
+}
@@ -17,7 +17,13 @@
 #include "../parse/Parse.h"
 #include "../parse/ParseExcept.h"
 #include "../parse/Emitter.h"
+#include "../opt/IRCache.h"
+#include "../opt/MemReport.h"
+#include "../opt/Passes.h"
+#include "../opt/Trace.h"
+#include <memory>
 #include <iostream>
+#include <string>
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-qual"
 #pragma clang diagnostic push
@@ -29,6 +35,213 @@
 
 using namespace uscc;
 
+// Returns the optimization level (0 if none was requested).
+// -O is the same as -O1.
+static unsigned getOptLevel(ez::ezOptionParser& opt)
+{
+	if (opt.isSet("-O3"))
+	{
+		return 3;
+	}
+	else if (opt.isSet("-O2"))
+	{
+		return 2;
+	}
+	else if (opt.isSet("-O1") || opt.isSet("-O"))
+	{
+		return 1;
+	}
+	return 0;
+}
+
+// Collects the settings for the opt passes
+static opt::OptOptions getOptOptions(ez::ezOptionParser& opt)
+{
+	opt::OptOptions options;
+	options.mLevel = getOptLevel(opt);
+	unsigned long unroll = 0;
+	opt.get("--unroll")->getULong(unroll);
+	options.mUnrollFactor = static_cast<unsigned>(unroll);
+	if (opt.isSet("--passes"))
+	{
+		opt.get("--passes")->getString(options.mPipeline);
+	}
+	return options;
+}
+
+// Sets up the IR cache, if requested. Entries made with
+// different optimization settings are kept apart.
+static opt::IRCache* createCache(ez::ezOptionParser& opt)
+{
+	// Cached functions wouldn't have the profile counters, weights,
+	// hooks or debug info
+	if (!opt.isSet("--cache-dir") ||
+		opt.isSet("--profile-generate") || opt.isSet("--profile-use") ||
+		opt.isSet("--instrument-functions") || opt.isSet("--buffered-output") ||
+		opt.isSet("-g"))
+	{
+		return nullptr;
+	}
+	std::string cacheDir;
+	opt.get("--cache-dir")->getString(cacheDir);
+	std::string tag = "O0";
+	unsigned level = getOptLevel(opt);
+	if (level > 0)
+	{
+		tag = level == 1 ? "O" : "O" + std::to_string(level);
+		opt::OptOptions options = getOptOptions(opt);
+		if (options.mUnrollFactor > 1)
+		{
+			tag += "-u" + std::to_string(options.mUnrollFactor);
+		}
+		if (!options.mPipeline.empty())
+		{
+			tag += "-" + opt::pipelineTag(options.mPipeline);
+		}
+	}
+	return new opt::IRCache(cacheDir, tag);
+}
+
+// Returns the -o file name, or if useDefault is set (or there is no -o),
+// the input file with the extension replaced with ext
+static std::string getOutputName(ez::ezOptionParser& opt, const char* fileName,
+								 const char* ext, bool useDefault)
+{
+	std::string outFile;
+	if (!opt.isSet("-o") || useDefault)
+	{
+		outFile = fileName;
+		size_t extLoc = outFile.find_last_of(".");
+		if (extLoc != std::string::npos)
+		{
+			// Strip the last extension
+			outFile = outFile.substr(0, extLoc);
+		}
+		outFile += ext;
+	}
+	else
+	{
+		opt.get("-o")->getString(outFile);
+	}
+	return outFile;
+}
+
+// Writes the --trace file when the compile is done, however it ends
+struct TraceGuard
+{
+	TraceGuard(ez::ezOptionParser& opt)
+	: mActive(opt.isSet("--trace"))
+	{
+		if (mActive)
+		{
+			std::string traceFile;
+			opt.get("--trace")->getString(traceFile);
+			opt::Trace::start(traceFile);
+		}
+	}
+	
+	~TraceGuard()
+	{
+		if (mActive && !opt::Trace::stop())
+		{
+			std::cerr << "uscc: error: Unable to write --trace file." << std::endl;
+		}
+	}
+	
+	bool mActive;
+};
+
+// Writes the --stats file, if requested
+static bool saveStats(ez::ezOptionParser& opt, const std::vector<opt::OptStats>& stats)
+{
+	if (!opt.isSet("--stats"))
+	{
+		return true;
+	}
+	std::string statsFile;
+	opt.get("--stats")->getString(statsFile);
+	if (!opt::saveOptStats(statsFile.c_str(), stats))
+	{
+		std::cerr << "uscc: error: Unable to write --stats file." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Streaming compilation: each function is emitted, optimized and
+// (with -s) compiled to assembly as soon as it's parsed, after which
+// its AST, scope and IR are freed.
+static int compileStreaming(ez::ezOptionParser& opt, const char* fileName)
+{
+	if (opt.isSet("-a") || opt.isSet("-c") || opt.isSet("--run") ||
+		(opt.isSet("-s") && opt.isSet("-b")) ||
+		opt.isSet("--profile-generate") || opt.isSet("--profile-use") ||
+		opt.isSet("--instrument-functions") || opt.isSet("--buffered-output") ||
+		opt.isSet("-g"))
+	{
+		std::cerr << "uscc: error: --stream can't be used with -a, -c, --run,"
+			" --profile-generate, --profile-use, --instrument-functions,"
+			" --buffered-output, -g, or with both -s and -b." << std::endl;
+		return 1;
+	}
+	
+	std::unique_ptr<opt::IRCache> cache(createCache(opt));
+	opt::OptOptions optOptions = getOptOptions(opt);
+	std::vector<opt::OptStats> stats;
+	if (opt.isSet("--stats"))
+	{
+		optOptions.mStats = &stats;
+	}
+	parse::Emitter emit(optOptions.mLevel > 0, cache.get(), &optOptions);
+	
+	if (opt.isSet("-s"))
+	{
+		unsigned long numColors = 0;
+		opt.get("--num-colors")->getULong(numColors);
+		std::string raStatsFile;
+		if (opt.isSet("--ra-stats"))
+		{
+			opt.get("--ra-stats")->getString(raStatsFile);
+		}
+		
+		std::string asmFile = getOutputName(opt, fileName, ".s", false);
+		if (!emit.streamAsm(asmFile.c_str(), numColors,
+							raStatsFile.empty() ? nullptr : raStatsFile.c_str()))
+		{
+			std::cerr << "uscc: error: Unable to emit assembly. Compilation halted." << std::endl;
+			return 1;
+		}
+	}
+	
+	parse::Parser parser(fileName, &std::cerr, nullptr, false, &emit);
+	if (!parser.IsValid())
+	{
+		std::cerr << parser.GetNumErrors() << " Error(s)" << std::endl;
+		return 1;
+	}
+	
+	if (!emit.finish())
+	{
+		std::cerr << std::endl;
+		std::cerr << "uscc: error: Emitted bad IR. Compilation halted." << std::endl;
+		return 1;
+	}
+	opt::MemReport::write("compile", std::cerr);
+	
+	if (opt.isSet("-p"))
+	{
+		emit.print();
+	}
+	
+	if (!opt.isSet("-s"))
+	{
+		std::string bcFile = getOutputName(opt, fileName, ".bc", false);
+		emit.writeBitcode(bcFile.c_str());
+	}
+	
+	return saveStats(opt, stats) ? 0 : 1;
+}
+
 int main(int argc, const char * argv[])
 {
 	ez::ezOptionParser opt;
@@ -41,7 +254,7 @@ int main(int argc, const char * argv[])
 			"-h", "--help");
 	opt.add("", false, 0, 0,
 			"Output parse AST to stdout, and do not proceed to further compilation steps. "
-			"(Unless -b or -s is also specified.)",
+			"(Unless -b, -s or -c is also specified.)",
 			"-a", "--print-ast");
 	opt.add("", false, 0, 0,
 			"(DEFAULT) Generates LLVM bitcode file."
@@ -56,17 +269,127 @@ int main(int argc, const char * argv[])
 			"Output LLVM IR to stdout.",
 			"-p", "--print-bc");
 	opt.add("", false, 0, 0,
-			"Enable optimization passes.",
+			"Emit debug line tables, so the output of -s and -c maps instructions back"
+			" to lines in the .usc file (for perf annotate, gdb and so on). Disables"
+			" --cache-dir, and can't be used with --split-codegen or --stream.",
+			"-g", "--debug");
+	opt.add("", false, 0, 0,
+			"Enable optimization passes. Same as -O1.",
 			"-O");
+	opt.add("", false, 0, 0,
+			"Run the uscc optimization passes.",
+			"-O1");
+	opt.add("", false, 0, 0,
+			"Run the uscc optimization passes, followed by LLVM's standard scalar passes"
+			" (SROA, instcombine, GVN, SCCP, loop rotation and so on).",
+			"-O2");
+	opt.add("", false, 0, 0,
+			"Everything in -O2, plus loop and SLP vectorization, and inlining. Inlining"
+			" runs after each function is optimized (and cached), and is skipped with --stream.",
+			"-O3");
+	opt.add("0", false, 1, 0,
+			"With -O, unroll loops that count up or down by one to a limit this many times,"
+			" with the original loop running the leftover iterations. Loops with a small"
+			" constant trip count are always unrolled fully.",
+			"--unroll");
+	opt.add("", false, 1, 0,
+			"With -O, run these uscc passes instead of the default pipeline. Passes are"
+			" separated by commas (tailrec, constops, constbr, deadblocks, narrow, adce, licm,"
+			" unroll, cfgsimplify, printf). A group in brackets, like [constops,constbr,deadblocks]*3,"
+			" is repeated until none of its passes change anything, up to 3 times (4 if the"
+			" count is left out).\n\nThe default is"
+			" tailrec,constops,constbr,deadblocks,narrow,adce,licm,unroll,cfgsimplify,printf",
+			"--passes");
+	opt.add("", false, 1, 0,
+			"Add counters for every block and branch to the program, which it writes to"
+			" the specified file when it exits. Use the file with --profile-use to compile"
+			" the same source again. Disables --cache-dir.",
+			"--profile-generate");
+	opt.add("", false, 1, 0,
+			"Read a profile written by a --profile-generate build of the same source, and"
+			" use the counts as branch weights, which guide block placement, spill weights,"
+			" inlining (-O3) and --unroll. Functions that changed since the profile was made"
+			" are compiled as if there were no profile. Disables --cache-dir.",
+			"--profile-use");
+	opt.add("", false, 0, 0,
+			"Make every function call the uscc runtime when it's entered and when it"
+			" returns. The runtime (uscc_rt.bc, next to uscc) is linked in, and when the"
+			" program exits it writes a flat profile of the calls and cycles (rdtsc) spent"
+			" in each function to stderr, or to the file in $USCC_PROFILE_OUT."
+			" Disables --cache-dir.",
+			"--instrument-functions");
+	opt.add("", false, 0, 0,
+			"Print through the uscc runtime's buffered output routines instead of printf."
+			" Calls to printf with a constant format using only %d, %c and %s are replaced"
+			" with them, and the output is written when the buffer fills up, before any other"
+			" printf, and when the program exits. The runtime (uscc_rt.bc, next to uscc) is"
+			" linked in. Disables --cache-dir.",
+			"--buffered-output");
+	opt.add("1", false, 1, 0,
+			"Number of threads to use when optimizing with -O, and for --split-codegen."
+			" Functions are processed concurrently and put back in their original order,"
+			" so the output doesn't depend on the number of threads.",
+			"-j", "--jobs");
 	opt.add("", false, 0, 0,
 			"Generate an x86 assembly file from the LLVM IR generated by uscc."
 			" No optimization is performed."
 			"\n\nThis is provided for convenience in case LLVM developer tools (specifically llc)"
 			" are not installed. GCC or clang can turn this assembly file into an executable.",
 			"-s", "--assembly");
-	opt.add("4", false, 1, 0, "Specify number of colors for register graph coloring", "--num-colors");
+	opt.add("", false, 0, 0,
+			"With -s, compile each function to assembly separately, on as many threads as"
+			" --jobs allows, and concatenate the results in order. The output is the same for"
+			" any number of threads. Object files (-c) are always generated on one thread."
+			" Can't be used with -g, --buffered-output, --instrument-functions or"
+			" --profile-generate.",
+			"--split-codegen");
+	opt.add("", false, 0, 0,
+			"Generate an object file from the LLVM IR generated by uscc, using the same"
+			" code generator as -s but without going through textual assembly.",
+			"-c", "--object");
+	opt.add("", false, 0, 0,
+			"JIT compile the program and run it in-process, passing through its output"
+			" and returning its exit code. No bitcode is written unless -b is also specified.",
+			"--run");
+	opt.add("0", false, 1, 0,
+			"Cap the number of colors used for register graph coloring."
+			" By default each register class uses all of its allocatable registers.",
+			"--num-colors");
+	opt.add("", false, 1, 0,
+			"Write register allocation statistics (graph size, spills, reloads, splits and time"
+			" per function) as JSON to the specified file. Only used with -s or -c.",
+			"--ra-stats");
+	opt.add("", false, 1, 0,
+			"Write statistics for the uscc passes (instructions folded, branches folded,"
+			" blocks removed, instructions hoisted, trivial phis removed and so on) per"
+			" function to the specified file, as JSON if it ends in .json, or else as a"
+			" table followed by the totals. Functions loaded from --cache-dir aren't counted.",
+			"--stats");
 	opt.add("", false, 1, 0,
-			"Specify output file. This is ignored if -b and -s are specified simultaneously.",
+			"Write a timeline of the compile to the specified file, in Chrome's trace event"
+			" format (open it with chrome://tracing or Perfetto). It has a span for parsing"
+			" and emitting each function, each pass on each function, and register"
+			" allocation, on the thread it ran on.",
+			"--trace");
+	opt.add("", false, 0, 0,
+			"Count the memory allocated by each part of the compiler (AST, symbol and string"
+			" tables, SSA construction, errors, LLVM IR and code generation), and write the"
+			" bytes and allocations still live in each to stderr after each phase.",
+			"--mem-report");
+	opt.add("", false, 1, 0,
+			"Cache the IR of each function in the specified directory. Functions that are"
+			" unchanged since the last compile (same tokens and callee signatures) reuse"
+			" the cached IR instead of being emitted and optimized again.",
+			"--cache-dir");
+	opt.add("", false, 0, 0,
+			"Compile each function as soon as it is parsed, and then free it, so memory use"
+			" depends on the largest function rather than the whole file. With -s, each"
+			" function is compiled to assembly and its IR freed right away. Can't be used"
+			" with -a, -c or --run.",
+			"--stream");
+	opt.add("", false, 1, 0,
+			"Specify output file. This is ignored if more than one of -b, -s and -c"
+			" are specified simultaneously.",
 			"-o", "--output");
 	
 	opt.parse(argc, argv);
@@ -89,6 +412,54 @@ int main(int argc, const char * argv[])
 		return 1;
 	}
 	
+	if (opt.isSet("--passes"))
+	{
+		std::string spec;
+		std::string error;
+		opt.get("--passes")->getString(spec);
+		if (!opt::checkPipeline(spec, error))
+		{
+			std::cerr << "uscc: error: Bad --passes: " << error << std::endl;
+			return 1;
+		}
+	}
+	
+	if (opt.isSet("-g") && opt.isSet("--split-codegen"))
+	{
+		std::cerr << "uscc: error: -g can't be used with --split-codegen." << std::endl;
+		return 1;
+	}
+	
+	// These add module-wide state (globals shared by every function, and
+	// destructors that write it out), which the per-function partitions
+	// of --split-codegen would each get a copy of, or lose entirely
+	const char* moduleStateOptions[] = {
+		"--buffered-output",
+		"--instrument-functions",
+		"--profile-generate",
+	};
+	for (const char* option : moduleStateOptions)
+	{
+		if (opt.isSet(option) && opt.isSet("--split-codegen"))
+		{
+			std::cerr << "uscc: error: " << option << " can't be used with --split-codegen."
+				<< std::endl;
+			return 1;
+		}
+	}
+	
+	if (opt.isSet("--profile-generate") && opt.isSet("--profile-use"))
+	{
+		std::cerr << "uscc: error: --profile-generate and --profile-use can't be used together."
+			<< std::endl;
+		return 1;
+	}
+	
+	TraceGuard trace(opt);
+	if (opt.isSet("--mem-report"))
+	{
+		opt::MemReport::start();
+	}
 	const char* fileName = opt.lastArgs[0]->c_str();
 	std::ostream* astStream = nullptr;
 	bool outputSymbols = false;
@@ -104,6 +475,11 @@ int main(int argc, const char * argv[])
 	
 	try
 	{
+		if (opt.isSet("--stream"))
+		{
+			return compileStreaming(opt, fileName);
+		}
+		
 		parse::Parser parser(fileName, &std::cerr, astStream, outputSymbols);
 		
 		if (!parser.IsValid())
@@ -111,25 +487,86 @@ int main(int argc, const char * argv[])
 			std::cerr << parser.GetNumErrors() << " Error(s)" << std::endl;
 			return 1;
 		}
+		opt::MemReport::write("parse", std::cerr);
 		
 		// If we set -a, we don't continue to later steps
 		if (opt.isSet("-a") &&
-			!opt.isSet("-b") && !opt.isSet("-s") && !opt.isSet("-p"))
+			!opt.isSet("-b") && !opt.isSet("-s") && !opt.isSet("-c") && !opt.isSet("-p") &&
+			!opt.isSet("--run"))
 		{
 			return 0;
 		}
 		
+		std::unique_ptr<opt::IRCache> cache(createCache(opt));
+		
 		// Now emit LLVM bitcode
-		parse::Emitter emit(parser);
+		opt::OptOptions optOptions = getOptOptions(opt);
+		std::vector<opt::OptStats> stats;
+		if (opt.isSet("--stats"))
+		{
+			optOptions.mStats = &stats;
+		}
+		parse::Emitter emit(parser, cache.get(), optOptions.mStats,
+							opt.isSet("--instrument-functions"), opt.isSet("-g"));
+		opt::MemReport::write("emit", std::cerr);
+		
+		// Profiles are made and used on the IR as it was emitted
+		if (opt.isSet("--profile-generate"))
+		{
+			std::string profileFile;
+			opt.get("--profile-generate")->getString(profileFile);
+			emit.instrumentProfile(profileFile.c_str());
+		}
+		else if (opt.isSet("--profile-use"))
+		{
+			std::string profileFile;
+			opt.get("--profile-use")->getString(profileFile);
+			if (!emit.useProfile(profileFile.c_str()))
+			{
+				std::cerr << "uscc: error: Unable to read --profile-use file." << std::endl;
+				return 1;
+			}
+		}
+		
+		if (opt.isSet("--buffered-output"))
+		{
+			emit.bufferOutput();
+		}
 		
 		// Check if we should run optimization passes
-		if (opt.isSet("-O"))
+		if (optOptions.mLevel > 0)
+		{
+			unsigned long jobs = 1;
+			opt.get("--jobs")->getULong(jobs);
+			emit.optimize(static_cast<unsigned>(jobs), &optOptions);
+		}
+		
+		// Inlining depends on the callees, so it isn't cached. The
+		// functions are cached before it runs (if their IR is good).
+		bool cached = false;
+		if (optOptions.mLevel >= 3 && emit.verify())
 		{
-			emit.optimize();
+			emit.updateCache();
+			cached = true;
+			emit.optimizeInterproc(&optOptions);
+		}
+		
+		// The runtime is linked in after optimizing, so the uscc
+		// passes only see code uscc made
+		if ((opt.isSet("--instrument-functions") || opt.isSet("--buffered-output")) &&
+			!emit.linkRuntime(argv[0]))
+		{
+			std::cerr << "uscc: error: Unable to link the uscc runtime." << std::endl;
+			return 1;
+		}
+		// Each report is only written if its phase ran
+		if (optOptions.mLevel > 0)
+		{
+			opt::MemReport::write("optimize", std::cerr);
 		}
 		
 		bool shouldEmitBC = true;
-		if (opt.isSet("-s") && !opt.isSet("-b"))
+		if ((opt.isSet("-s") || opt.isSet("-c") || opt.isSet("--run")) && !opt.isSet("-b"))
 		{
 			shouldEmitBC = false;
 		}
@@ -148,62 +585,99 @@ int main(int argc, const char * argv[])
 			return 1;
 		}
 		
+		// Only cache functions once we know the IR is good
+		if (!cached)
+		{
+			emit.updateCache();
+		}
+		
+		if (!saveStats(opt, stats))
+		{
+			return 1;
+		}
+		
 		// Write the bitcode file
 		if (shouldEmitBC)
 		{
-			std::string bcFile;
-			// If output file not specified, default is
-			// input file with the extension replaced with .bc
-			if (!opt.isSet("-o") || opt.isSet("-s"))
-			{
-				bcFile = fileName;
-				size_t extLoc = bcFile.find_last_of(".");
-				if (extLoc != std::string::npos)
-				{
-					// Strip the last extension
-					bcFile = bcFile.substr(0, extLoc);
-				}
-				bcFile += ".bc";
-			}
-			else
-			{
-				ez::OptionGroup* params = opt.get("-o");
-				params->getString(bcFile);
-			}
+			// -o only names this file if it's the only output
+			std::string bcFile = getOutputName(opt, fileName, ".bc",
+											   opt.isSet("-s") || opt.isSet("-c"));
 			
 			emit.writeBitcode(bcFile.c_str());
 		}
 		
+		// Code generation settings shared by -s and -c
+		ez::OptionGroup* params = opt.get("--num-colors");
+		unsigned long numColors = 0;
+		params->getULong(numColors);
+		std::string raStatsFile;
+		if (opt.isSet("--ra-stats"))
+		{
+			opt.get("--ra-stats")->getString(raStatsFile);
+		}
+		
 		// Functionality removed because it doesn't work with LLVM 3.5.0
 		// Write the assembly file
+		std::string asmFile;
+		bool wroteAsm = false;
 		if (opt.isSet("-s"))
 		{
-			std::string asmFile;
-			// If output file not specified, default is
-			// input file with the extension replaced with .bc
-			if (!opt.isSet("-o") || opt.isSet("-b"))
+			// -o only names this file if it's the only output
+			asmFile = getOutputName(opt, fileName, ".s",
+									opt.isSet("-b") || opt.isSet("-c"));
+			bool success;
+			if (opt.isSet("--split-codegen"))
 			{
-				asmFile = fileName;
-				size_t extLoc = asmFile.find_last_of(".");
-				if (extLoc != std::string::npos)
-				{
-					// Strip the last extension
-					asmFile = asmFile.substr(0, extLoc);
-				}
-				asmFile += ".s";
+				unsigned long jobs = 1;
+				opt.get("--jobs")->getULong(jobs);
+				success = emit.writeAsmSplit(asmFile.c_str(), static_cast<unsigned>(jobs), numColors,
+											 raStatsFile.empty() ? nullptr : raStatsFile.c_str());
 			}
 			else
 			{
-				ez::OptionGroup* params = opt.get("-o");
-				params->getString(asmFile);
+				success = emit.writeAsm(asmFile.c_str(), numColors,
+										raStatsFile.empty() ? nullptr : raStatsFile.c_str());
 			}
-			ez::OptionGroup* params = opt.get("--num-colors");
-			unsigned long numColors = 4;
-			params->getULong(numColors);
-			if (!emit.writeAsm(asmFile.c_str(), numColors))
+			if (!success)
 			{
 				std::cerr << "uscc: error: Unable to emit assembly. Compilation halted." << std::endl;
+				return 1;
+			}
+			wroteAsm = true;
+		}
+		
+		// Write the object file
+		if (opt.isSet("-c"))
+		{
+			// -o only names this file if it's the only output
+			std::string objFile = getOutputName(opt, fileName, ".o",
+												opt.isSet("-b") || opt.isSet("-s"));
+			// With -s too, the assembly is assembled rather than compiled again
+			bool success = wroteAsm ?
+				emit.assembleObject(asmFile.c_str(), objFile.c_str()) :
+				emit.writeObject(objFile.c_str(), numColors,
+								 raStatsFile.empty() ? nullptr : raStatsFile.c_str());
+			if (!success)
+			{
+				std::cerr << "uscc: error: Unable to emit object file. Compilation halted." << std::endl;
+				return 1;
+			}
+		}
+		if (opt.isSet("-s") || opt.isSet("-c"))
+		{
+			opt::MemReport::write("codegen", std::cerr);
+		}
+		
+		// Run the program last, since the JIT's code generation modifies the IR
+		if (opt.isSet("--run"))
+		{
+			int exitCode = 0;
+			if (!emit.run(fileName, exitCode))
+			{
+				std::cerr << "uscc: error: Unable to JIT the program." << std::endl;
+				return 1;
 			}
+			return exitCode;
 		}
 	}
 	catch (parse::FileNotFound& fe)